@@ -0,0 +1,126 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_BLOCK_OCCUPANCY_HPP
+#define INC_BLOCK_OCCUPANCY_HPP
+
+#include "Platform.hpp"
+
+#include <atomic>
+#include <cassert>
+
+// One block of track which a single train may hold at a time
+// Blocks are claimed with compare-and-swap so trains being updated on
+// different threads can reserve track without taking a global lock
+class TrackBlock {
+public:
+   // Train numbers must not be zero
+   static const unsigned FREE = 0;
+
+   TrackBlock() : word(FREE) {}
+
+   // True if the train now holds the block, including if it already did
+   bool reserve(unsigned train)
+   {
+      assert(train != FREE);
+
+      unsigned expected = FREE;
+      return word.compare_exchange_strong(
+         expected, train, memory_order_acq_rel, memory_order_acquire)
+         || expected == train;
+   }
+
+   // Give up the block once the tail of the train has left it
+   // Returns false if the train didn't hold it
+   bool release(unsigned train)
+   {
+      unsigned expected = train;
+      return word.compare_exchange_strong(
+         expected, FREE, memory_order_release, memory_order_relaxed);
+   }
+
+   // The train holding the block or FREE
+   unsigned holder() const
+   {
+      return word.load(memory_order_acquire);
+   }
+
+private:
+   TrackBlock(const TrackBlock&);
+   TrackBlock& operator=(const TrackBlock&);
+
+   atomic<unsigned> word;
+};
+
+typedef shared_ptr<TrackBlock> TrackBlockPtr;
+
+// A fixed number of blocks referred to by index
+class BlockOccupancy {
+public:
+   static const unsigned FREE = TrackBlock::FREE;
+
+   explicit BlockOccupancy(size_t n_blocks)
+      : blocks(new TrackBlock[n_blocks]), n_blocks(n_blocks)
+   {}
+
+   size_t size() const { return n_blocks; }
+
+   bool reserve(unsigned block, unsigned train)
+   {
+      assert(block < n_blocks);
+      return blocks[block].reserve(train);
+   }
+
+   // Claim every block on a route or none of them
+   // The train must not already hold any of the blocks
+   bool reserve_route(const unsigned* begin, const unsigned* end,
+                      unsigned train)
+   {
+      for (const unsigned* b = begin; b != end; ++b) {
+         assert(holder(*b) != train);
+
+         if (!reserve(*b, train)) {
+            for (const unsigned* u = begin; u != b; ++u)
+               release(*u, train);
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   bool release(unsigned block, unsigned train)
+   {
+      assert(block < n_blocks);
+      return blocks[block].release(train);
+   }
+
+   unsigned holder(unsigned block) const
+   {
+      assert(block < n_blocks);
+      return blocks[block].holder();
+   }
+
+private:
+   BlockOccupancy(const BlockOccupancy&);
+   BlockOccupancy& operator=(const BlockOccupancy&);
+
+   unique_ptr<TrackBlock[]> blocks;
+   size_t n_blocks;
+};
+
+#endif
@@ -0,0 +1,69 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_CONSIST_HPP
+#define INC_CONSIST_HPP
+
+#include "Platform.hpp"
+
+#include <vector>
+#include <cassert>
+
+// The physical properties of every vehicle in a train stored as
+// contiguous arrays so the forces on the whole train can be summed
+// in a single loop the compiler can vectorise
+class Consist {
+public:
+   // Add a vehicle to the back of the train
+   void add(double mass)
+   {
+      masses.push_back(mass);
+      gradients.push_back(0.0);
+   }
+
+   size_t size() const { return masses.size(); }
+
+   // Set the gradient under vehicle i in its direction of travel
+   void set_gradient(size_t i, double gradient)
+   {
+      assert(i < size());
+      gradients[i] = gradient;
+   }
+
+   double gradient(size_t i) const { return gradients[i]; }
+   double mass(size_t i) const { return masses[i]; }
+
+   // Total force acting on the train due to gravity
+   double gravity() const
+   {
+      const double g = 9.78;
+      const size_t n = size();
+      const double* m = masses.data();
+      const double* grad = gradients.data();
+
+      double sum = 0.0;
+      for (size_t i = 0; i < n; i++)
+         sum += grad[i] * m[i];
+
+      return -g * sum;
+   }
+
+private:
+   vector<double> masses, gradients;
+};
+
+#endif
@@ -0,0 +1,198 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_HEIGHT_CODEC_HPP
+#define INC_HEIGHT_CODEC_HPP
+
+#include "Platform.hpp"
+
+#include <vector>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+
+// Compact encoding of a grid of terrain heights
+//
+// Each height is rounded to a multiple of STEP and stored as the
+// difference from the height in the row before it, or the height to
+// its left on the first row. Most of the terrain is flat or a regular
+// slope so most differences are zero or repeat: runs of zeros are
+// stored as a count and everything else as a variable length integer
+//
+//   0x00 n    Run of n zero differences
+//   v         Any other difference d with v = zigzag(d) which is never
+//             zero so the first byte can't be confused with a run
+//
+// n and v are stored seven bits at a time, low bits first, with the
+// top bit set on every byte but the last
+namespace height_codec {
+
+   // A power of two so every stored height is exact in a float
+   const float STEP = 1.0f / 1024.0f;
+
+   // Heights outside this range can't be encoded
+   const float MAX_HEIGHT = 32767.0f * STEP;
+
+   namespace detail {
+
+      inline void put_varint(vector<uint8_t>& out, uint32_t v)
+      {
+         while (v >= 0x80) {
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+         }
+         out.push_back(static_cast<uint8_t>(v));
+      }
+
+      inline uint32_t get_varint(const uint8_t*& p, const uint8_t* end)
+      {
+         uint32_t v = 0;
+         for (int shift = 0; shift < 35; shift += 7) {
+            if (p == end)
+               throw runtime_error("Height map data is truncated");
+
+            const uint8_t b = *p++;
+            v |= static_cast<uint32_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+               return v;
+         }
+
+         throw runtime_error("Bad number in height map data");
+      }
+
+      inline uint32_t zigzag(int32_t d)
+      {
+         return (static_cast<uint32_t>(d) << 1)
+            ^ static_cast<uint32_t>(d >> 31);
+      }
+
+      inline int32_t unzigzag(uint32_t v)
+      {
+         return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+      }
+
+      // Height to the left on the first row otherwise the one before
+      inline int32_t predict(const int16_t* q, size_t i, size_t columns)
+      {
+         return i >= columns ? q[i - columns] : (i > 0 ? q[i - 1] : 0);
+      }
+   }
+
+   // Returns false if a height is out of range, in which case the
+   // heights should be stored as they are
+   inline bool encode(const float* heights, int columns, int rows,
+                      vector<uint8_t>& out)
+   {
+      using namespace detail;
+
+      const size_t n = size_t(columns) * rows;
+
+      vector<int16_t> q(n);
+      for (size_t i = 0; i < n; i++) {
+         if (!(fabsf(heights[i]) <= MAX_HEIGHT))
+            return false;
+
+         q[i] = static_cast<int16_t>(floorf(heights[i] / STEP + 0.5f));
+      }
+
+      out.clear();
+
+      uint32_t run = 0;
+      for (size_t i = 0; i < n; i++) {
+         const int32_t d = q[i] - predict(&q[0], i, columns);
+
+         if (d == 0)
+            run++;
+         else {
+            if (run > 0) {
+               out.push_back(0);
+               put_varint(out, run);
+               run = 0;
+            }
+
+            put_varint(out, zigzag(d));
+         }
+      }
+
+      if (run > 0) {
+         out.push_back(0);
+         put_varint(out, run);
+      }
+
+      return true;
+   }
+
+   // Throws if the data is damaged or doesn't fill the grid exactly
+   inline void decode(const uint8_t* data, size_t length,
+                      int columns, int rows, float* heights)
+   {
+      using namespace detail;
+
+      const size_t n = size_t(columns) * rows;
+      vector<int16_t> q(n);
+
+      const uint8_t* p = data;
+      const uint8_t* const end = data + length;
+
+      size_t i = 0;
+      while (i < n) {
+         if (p == end)
+            throw runtime_error("Height map data is truncated");
+
+         if (*p == 0) {
+            ++p;
+            const uint32_t run = get_varint(p, end);
+            if (run == 0 || run > n - i)
+               throw runtime_error("Bad run in height map data");
+
+            // Copy the whole run from the row before in one go
+            size_t left = run;
+            while (left > 0 && i < size_t(columns)) {
+               q[i] = static_cast<int16_t>(predict(&q[0], i, columns));
+               i++;
+               left--;
+            }
+
+            if (left > 0) {
+               // Source and destination overlap for runs over a row
+               for (size_t copied = 0; copied < left; ) {
+                  const size_t chunk = min(left - copied, size_t(columns));
+                  memcpy(&q[i + copied], &q[i + copied - columns],
+                         chunk * sizeof(int16_t));
+                  copied += chunk;
+               }
+               i += left;
+            }
+         }
+         else {
+            const int32_t d = unzigzag(get_varint(p, end));
+            q[i] = static_cast<int16_t>(predict(&q[0], i, columns) + d);
+            i++;
+         }
+      }
+
+      if (p != end)
+         throw runtime_error("Extra data after height map");
+
+      for (size_t j = 0; j < n; j++)
+         heights[j] = q[j] * STEP;
+   }
+}
+
+#endif
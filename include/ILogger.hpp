@@ -21,12 +21,16 @@
 #include "Platform.hpp"
 
 #include <ostream>
+#include <sstream>
 
 // Stream surrogate for writing log data to
+// The line is built up here and written out in one go when it is
+// destroyed so lines logged from different threads don't interleave
 struct PrintLine {
-   PrintLine(std::ostream& a_stream);
+   PrintLine(std::ostream& a_target);
    ~PrintLine();
-   std::ostream& stream;
+   std::ostringstream stream;
+   std::ostream& target;
 };
 
 typedef shared_ptr<PrintLine> PrintLinePtr;
@@ -24,10 +24,37 @@
 #include "IResource.hpp"
 #include "IScenery.hpp"
 #include "Colour.hpp"
+#include "BlockOccupancy.hpp"
 
 #include <memory>
 #include <string>
 
+// Interface for objects that want to know when the track changes
+struct ITrackListener {
+   virtual ~ITrackListener() {}
+
+   // The track or stations on these tiles have been added, removed
+   // or replaced
+   virtual void track_changed(const PointList& tiles) = 0;
+};
+
+typedef shared_ptr<ITrackListener> ITrackListenerPtr;
+
+// A save running on another thread
+// Only use this from the main thread
+struct IMapSave {
+   virtual ~IMapSave() {}
+
+   // Fraction of the map written so far
+   virtual float progress() const = 0;
+
+   // True once the save has finished
+   // Throws if the save failed
+   virtual bool done() = 0;
+};
+
+typedef shared_ptr<IMapSave> IMapSavePtr;
+
 // A map is a MxN array of floating point height values
 // It also contains the track layout and any scenery items
 class IMap {
@@ -53,6 +80,16 @@ public:
    // Return the station at this track location or a null pointer
    virtual IStationPtr station_at(Point<int> a_point) const = 0;
 
+   // Return the station on any endpoint of the track segment covering
+   // this tile or a null pointer
+   // This is remembered when the track changes so it's cheap to call
+   virtual IStationPtr station_on_track(const Point<int>& a_point) const = 0;
+
+   // Trains reserve the block covering a tile as they run onto it
+   // Each track segment is one block and it goes when the track does
+   // Returns a null pointer if there is no track here
+   virtual TrackBlockPtr track_block(const Point<int>& a_point) const = 0;
+
    // Delete the contents of a tile
    virtual void erase_tile(int x, int y) = 0;
 
@@ -77,6 +114,13 @@ public:
    // Save the map to its resource
    virtual void save() = 0;
 
+   // Save a compact binary copy of the map which loads faster
+   virtual void save_binary() = 0;
+
+   // Save a copy of the map as it is now on a loader thread
+   // The map can be changed while this runs
+   virtual IMapSavePtr save_in_background() = 0;
+
    // Return the name of the map resource
    virtual string name() const = 0;
 
@@ -128,6 +172,10 @@ public:
 
    // Place a tree, building, etc. at a location
    virtual void add_scenery(Point<int> where, ISceneryPtr s) = 0;
+
+   // Call the listener whenever the track changes. The map only keeps
+   // a weak reference so the listener must be owned elsewhere
+   virtual void add_track_listener(weak_ptr<ITrackListener> l) = 0;
    
 };
 
@@ -137,6 +185,10 @@ typedef shared_ptr<IMap> IMapPtr;
 IMapPtr make_empty_map(const string& a_res_id, int a_width, int a_height);
 
 // Load a map from a resource
+// The binary copy is used if there is one newer than the XML
 IMapPtr load_map(const string& a_res_id);
 
+// Load a map from its binary copy only
+IMapPtr load_binary_map(const string& a_res_id);
+
 #endif
@@ -33,6 +33,9 @@ struct IMeshBuffer {
    virtual ~IMeshBuffer() {}
 
    virtual size_t vertex_count() const = 0;
+
+   // Bytes used by this buffer and a mesh made from it
+   virtual size_t memory_size() const = 0;
    
    virtual void add(const Vertex& vertex,
                     const Normal& normal,
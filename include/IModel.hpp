@@ -43,4 +43,18 @@ IModelPtr load_model(IResourcePtr a_res,
                      float a_scale = 1.0f,
                      Vector<float> shift = make_vector(0.0f, 0.0f, 0.0f));
 
+// Free models read on the loader threads which were never loaded
+void discard_prefetched_models();
+
+// Read the limit on models held by the loader threads from the config
+// Call on the main thread before anything is prefetched
+void set_model_prefetch_budget();
+
+// Start reading a model on the loader threads so a later call to
+// load_model with the same arguments doesn't have to
+void prefetch_model(IResourcePtr a_res,
+                    const string& a_file_name,
+                    float a_scale = 1.0f,
+                    Vector<float> shift = make_vector(0.0f, 0.0f, 0.0f));
+
 #endif
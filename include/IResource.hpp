@@ -31,7 +31,7 @@
 struct IResource {
    virtual ~IResource() {}
 
-   virtual string name() const = 0;
+   virtual const string& name() const = 0;
    virtual string xml_file_name() const = 0;  // REMOVE
    // (Should be replaced by Handle open_xml_file()
    
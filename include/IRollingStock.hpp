@@ -22,6 +22,7 @@
 #include "IController.hpp"
 #include "Maths.hpp"
 #include "ICargo.hpp"
+#include "IResource.hpp"
 
 // Interface for various powered and unpowered parts of the train
 struct IRollingStock {
@@ -29,6 +30,9 @@ struct IRollingStock {
 
    // Update speed, fuel, etc.
    virtual void update(int delta, double gravity) = 0;
+
+   // False if update() does nothing so needn't be called
+   virtual bool powered() const = 0;
    
    // Display the model
    virtual void render() const = 0;
@@ -55,4 +59,8 @@ typedef shared_ptr<IRollingStock> IRollingStockPtr;
 IRollingStockPtr load_engine(const string& a_res_id);
 IRollingStockPtr load_waggon(const string& a_res_id);
 
+// Start reading the model on the loader threads
+void prefetch_engine(IResourcePtr a_res);
+void prefetch_waggon(IResourcePtr a_res);
+
 #endif
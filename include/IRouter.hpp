@@ -0,0 +1,58 @@
+//
+//  Copyright (C) 2011  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_IROUTER_HPP
+#define INC_IROUTER_HPP
+
+#include "ITrackGraph.hpp"
+
+#include <vector>
+
+// A route is the list of arcs to follow from one node to another
+typedef vector<graph::Arc> Route;
+
+// Finds shortest paths through the track graph
+// The distances to the most recently used destinations are remembered
+// until the track graph changes so repeated queries are cheap
+struct IRouter {
+   virtual ~IRouter() {}
+
+   // Find the shortest route between two nodes
+   // Returns false if there is no way to get there
+   virtual bool route(unsigned from, unsigned to, Route& r) = 0;
+
+   // Find the shortest route to any entry to a station
+   virtual bool route(unsigned from, IStationPtr to, Route& r) = 0;
+
+   // Length of the shortest route or a negative number if there is none
+   virtual float distance(unsigned from, unsigned to) = 0;
+
+   // Change the points along a route so a train will follow it
+   virtual void set_points(const Route& r) const = 0;
+
+   // Number of destinations found in the cache or worked out again
+   virtual unsigned cache_hits() const = 0;
+   virtual unsigned cache_misses() const = 0;
+};
+
+typedef shared_ptr<IRouter> IRouterPtr;
+
+// Remembers the distances to this many destinations or to every
+// entry to a station if zero
+IRouterPtr make_router(ITrackGraphPtr graph, unsigned cache_tables = 0);
+
+#endif
@@ -22,6 +22,7 @@
 #include "IXMLSerialisable.hpp"
 #include "IMesh.hpp"
 #include "IIndustry.hpp"
+#include "IResource.hpp"
 
 // Static scenery such as trees
 struct IScenery : IXMLSerialisable {
@@ -46,4 +47,8 @@ ISceneryPtr load_tree(const AttributeSet& attrs);
 ISceneryPtr load_building(const string& a_res_id, float angle);
 ISceneryPtr load_building(const AttributeSet& attrs);
 
+// Start reading the model on the loader threads
+void prefetch_tree(IResourcePtr a_res);
+void prefetch_building(IResourcePtr a_res);
+
 #endif
@@ -27,7 +27,7 @@ struct ISmokeTrail {
    // Move and generate new particles
    virtual void update(int a_delta) = 0;
    
-   // Draw all the particles
+   // Save the particles to be drawn at the end of the frame
    virtual void render() const = 0;
 
    // Change the position where new particles are generated
@@ -45,4 +45,7 @@ typedef shared_ptr<ISmokeTrail> ISmokeTrailPtr;
 
 ISmokeTrailPtr make_smoke_trail();
 
+// Draw the particles of every smoke trail saved during this frame
+void render_smoke_trails();
+
 #endif
@@ -44,6 +44,17 @@ ITexturePtr load_texture(const string& a_file_name);
 // Load a texture from a resource
 ITexturePtr load_texture(IResourcePtr a_res, const string& a_file_name);
 
+// Read the limit on images held by the loader threads from the config
+// Call on the main thread before anything is prefetched
+void set_texture_prefetch_budget();
+
+// Start decoding a texture on the loader threads so a later call to
+// load_texture only has to upload it
+void prefetch_texture(const string& a_file_name);
+
+// Free images decoded on the loader threads which were never loaded
+void discard_prefetched_textures();
+
 // Generate Perlin noise
 ITexturePtr make_noise_texture(int size, int resolution, int base, int range);
 
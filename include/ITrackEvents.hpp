@@ -0,0 +1,59 @@
+//
+//  Copyright (C) 2011  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_ITRACK_EVENTS_HPP
+#define INC_ITRACK_EVENTS_HPP
+
+#include "IterateTrack.hpp"
+
+// The next station, points or dead end along the track
+struct TrackEvent {
+   // One of TRACK_STATION, TRACK_CHOICE or TRACK_NO_MORE, or TRACK_OK
+   // if the track goes round in a loop with nothing on it
+   IterationStatus status;
+
+   // Number of segments before the one with the event: zero if the
+   // event is on the segment the train is entering
+   unsigned segments;
+
+   // Length of the track before the event
+   float distance;
+
+   ITrackSegmentPtr track;
+   IStationPtr station;
+};
+
+// Remembers the next event from everywhere a train can enter a piece of
+// track, so looking ahead doesn't have to iterate along the track
+// The answers are forgotten when the track near them changes
+struct ITrackEvents {
+   virtual ~ITrackEvents() {}
+
+   // The next event for a train entering track at this connection
+   // This includes the segment being entered
+   // The reference is only valid until the next call
+   virtual const TrackEvent& next_event(const track::Connection& entry) = 0;
+
+   // The next event after the segment being entered
+   virtual TrackEvent following_event(const track::Connection& entry) = 0;
+};
+
+typedef shared_ptr<ITrackEvents> ITrackEventsPtr;
+
+ITrackEventsPtr make_track_events(IMapPtr map);
+
+#endif
@@ -22,38 +22,59 @@
 
 namespace graph {
 
-   struct Arc;
-
    enum NodeType {
       NODE_ROOT,
       NODE_STATION,
-      NODE_POINTS
+      NODE_POINTS,
+      NODE_END         // Track runs out here
    };
-   
+
+   // A node is a place where a train enters a station, a set of
+   // points, or runs off the end of the track
    struct Node {
       unsigned id;
       NodeType type;
-      vector<Arc> arcs;
       ITrackSegmentPtr track;
+      track::Connection entry;
+      IStationPtr station;
    };
 
+   // A run of plain track between two nodes
    struct Arc {
       unsigned start, end;
       float length;
+
+      // Which way the train leaves the start node's segment
+      track::Connection exit;
    };
 }
 
+// A directed graph of the track layout where each run of ordinary
+// track is collapsed into a single weighted arc
 struct ITrackGraph {
    virtual ~ITrackGraph() {}
 
    virtual void write_dot_file(const string& file) const = 0;
-   
+
    virtual const graph::Node& root() const = 0;
-   virtual const graph::Node& node(unsigned n) const = 0;   
+   virtual const graph::Node& node(unsigned n) const = 0;
+   virtual unsigned node_count() const = 0;
+
+   // The arcs leaving a node are stored contiguously
+   virtual const graph::Arc* arcs_begin(unsigned n) const = 0;
+   virtual const graph::Arc* arcs_end(unsigned n) const = 0;
+
+   // Find the node for a train entering track at this connection
+   virtual bool find_node(const track::Connection& entry,
+                          unsigned& n) const = 0;
+
+   // Incremented every time the graph changes
+   virtual unsigned revision() const = 0;
 };
 
 typedef shared_ptr<ITrackGraph> ITrackGraphPtr;
 
+// The graph updates itself as the track on the map changes
 ITrackGraphPtr make_track_graph(IMapPtr map);
 
 #endif  // INC_ITRACK_GRAPH_HPP
@@ -26,6 +26,8 @@
 #include <vector>
 #include <set>
 
+struct ITrackSegment;
+
 // Types used for specifying track segments
 namespace track {
    // TODO: This only needs (x, y) position and should contain
@@ -42,11 +44,24 @@ namespace track {
    typedef int Angle;
 
    struct TravelToken;
-   typedef function<void (const TravelToken&, double)> TransformFunc;
-   typedef function<float (const TravelToken&, float)> GradientFunc;
+   typedef void (*TransformFunc)(const TravelToken&, float);
+   typedef float (*GradientFunc)(const TravelToken&, float);
 
    float flat_gradient_func(const TravelToken& t, float d);
 
+   // Table of functions for moving along one kind of track segment
+   // Each segment class has a single static instance of this which is
+   // shared by all the travel tokens it creates
+   struct TrackShape {
+      // Transforms the location of the train so it will render in the
+      // correct place for this track segment The functions assumes that
+      // it is initially placed at the origin
+      TransformFunc transform;
+
+      // Returns the gradient at any point
+      GradientFunc gradient;
+   };
+
    // Sums up all the information required to travel along a piece
    // of track
    struct TravelToken {
@@ -56,30 +71,43 @@ namespace track {
       // Position of entry
       Position position;
 
-      // A function that transforms the location of the train so it will
-      // render in the correct place for this track segment The functions
-      // assumes that it is initially placed at the origin
-      TransformFunc transformer;
+      // The segment that created this token and how to travel along it
+      const ITrackSegment* segment;
+      const TrackShape* shape;
 
-      // A function that returns the gradient at any point
-      GradientFunc gradientf;
+      // Extra shape-specific state, e.g. which way along a curve
+      int param;
 
       // Number of possible exits from this track segment given the direction
       // we are travelling in
       int num_exits;
 
-      // Wrappers for the above functions
+      // Wrappers for the shape functions
 
       void transform(float delta) const
       {
-         transformer(*this, delta);
+         shape->transform(*this, delta);
       }
 
       float gradient(float delta) const
       {
-         return gradientf(*this, delta);
+         return shape->gradient(*this, delta);
       }
    };
+
+   // Adapts a const member function of the segment class T into a
+   // TransformFunc or GradientFunc for use in a TrackShape
+   template <class T, void (T::*Func)(const TravelToken&, float) const>
+   void transform_member(const TravelToken& t, float d)
+   {
+      (static_cast<const T*>(t.segment)->*Func)(t, d);
+   }
+
+   template <class T, float (T::*Func)(const TravelToken&, float) const>
+   float gradient_member(const TravelToken& t, float d)
+   {
+      return (static_cast<const T*>(t.segment)->*Func)(t, d);
+   }
 }
 
 // Orientations for straight track
@@ -88,7 +116,6 @@ namespace axis {
    const track::Direction Y = make_vector(0, 0, 1);
 }
 
-struct ITrackSegment;
 typedef shared_ptr<ITrackSegment> ITrackSegmentPtr;
 
 typedef vector<PointI> PointList;
@@ -128,6 +155,12 @@ struct ITrackSegment : IXMLSerialisable {
    virtual track::Connection next_position(const track::TravelToken& a_token)
       const = 0;
 
+   // Add every connection a train entering with this token could leave
+   // by, whatever state the track is currently in. The first is the
+   // exit taken in the default state
+   virtual void get_exits(const track::TravelToken& a_token,
+                          vector<track::Connection>& exits) const = 0;
+
    // Add all the endpoints of the track segment to the given list
    // Note that an endpoint is not the same as what is returned
    // from `next_position' - e.g. a straight track that takes up
@@ -54,4 +54,8 @@ typedef shared_ptr<ITrain> ITrainPtr;
 
 ITrainPtr make_train(IMapPtr a_map);
 
+// A train that is never rendered: update() makes no OpenGL calls so
+// this can be used when there is no window
+ITrainPtr make_headless_train(IMapPtr a_map);
+
 #endif
@@ -24,6 +24,11 @@
 #include <string>
 #include <stdexcept>
 #include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
 
 #include <boost/lexical_cast.hpp>
 
@@ -32,27 +37,78 @@
 
 namespace {
 
+   // Conversions from attribute values
+   // The common numeric types are parsed in place without allocating
+
    template <class T>
-   T xml_attr_cast(const string& str);
+   T xml_attr_cast(const char* str);
+
+   inline void xml_attr_error(const char* type, const char* str)
+   {
+      throw runtime_error(string("Cannot parse ") + type
+                          + " attribute with value '" + str + "'");
+   }
 
    template <>
-   bool xml_attr_cast(const string& str)
+   inline int xml_attr_cast(const char* str)
    {
-      istringstream ss(str);
-      bool result;
+      char* end;
+      errno = 0;
+      const long l = strtol(str, &end, 10);
 
-      ss >> boolalpha >> result;  // Is boolalpha affected by locale?
+      if (end == str || *end != '\0' || errno == ERANGE
+          || l < INT_MIN || l > INT_MAX)
+         xml_attr_error("integer", str);
 
-      if (ss.fail())
-         throw runtime_error(
-            "Cannot parse Boolean attribute with value '"
-            + str + "'");
+      return static_cast<int>(l);
+   }
+
+   template <>
+   inline float xml_attr_cast(const char* str)
+   {
+      char* end;
+      errno = 0;
+      const float f = strtof(str, &end);
 
-      return result;
+      if (end == str || *end != '\0' || errno == ERANGE)
+         xml_attr_error("float", str);
+
+      return f;
    }
 
    template <>
-   Colour xml_attr_cast(const string& str)
+   inline double xml_attr_cast(const char* str)
+   {
+      char* end;
+      errno = 0;
+      const double d = strtod(str, &end);
+
+      if (end == str || *end != '\0' || errno == ERANGE)
+         xml_attr_error("double", str);
+
+      return d;
+   }
+
+   template <>
+   inline bool xml_attr_cast(const char* str)
+   {
+      if (strcmp(str, "true") == 0)
+         return true;
+      else if (strcmp(str, "false") == 0)
+         return false;
+
+      xml_attr_error("Boolean", str);
+      return false;
+   }
+
+   template <>
+   inline string xml_attr_cast(const char* str)
+   {
+      return str;
+   }
+
+   template <>
+   inline Colour xml_attr_cast(const char* str)
    {
       istringstream ss(str);
       int r, g, b;
@@ -60,15 +116,13 @@ namespace {
       ss >> r >> g >> b;
 
       if (ss.fail())
-         throw runtime_error(
-            "Cannot parse colour attribute with value '"
-            + str + "'");
+         xml_attr_error("colour", str);
 
       return make_rgb(r, g, b);
    }
 
    template <class T>
-   T xml_attr_cast(const string& str)
+   inline T xml_attr_cast(const char* str)
    {
       return boost::lexical_cast<T>(str);
    }
@@ -76,38 +130,30 @@ namespace {
 }
 
 // Container for attributes
+// Either wraps the attributes from the XML parser or a list of names
+// and values read from somewhere else such as a binary map
 class AttributeSet {
 public:
-   AttributeSet(const xercesc::Attributes& attrs)
-      : my_attrs(attrs) {}
+   typedef vector<pair<const string*, const string*> > Pairs;
 
-   bool has(const string& name) const
-   {
-      XMLCh* xml_name = xercesc::XMLString::transcode(name.c_str());
+   // Values are copied into the buffer which should be kept for the
+   // whole parse so looking up an attribute doesn't normally allocate
+   AttributeSet(const xercesc::Attributes& attrs, string& buf)
+      : my_attrs(&attrs), my_pairs(NULL), my_buf(&buf) {}
 
-      int index = my_attrs.getIndex(xml_name);
-      xercesc::XMLString::release(&xml_name);
+   AttributeSet(const Pairs& pairs)
+      : my_attrs(NULL), my_pairs(&pairs), my_buf(NULL) {}
 
-      return index != -1;
+   bool has(const string& name) const
+   {
+      return my_pairs ? find_pair(name) != NULL : find_index(name) != -1;
    }
 
    template <class T>
    T get(const string& a_name) const
    {
-      XMLCh* xml_name = xercesc::XMLString::transcode(a_name.c_str());
-
-      int index = my_attrs.getIndex(xml_name);
-      xercesc::XMLString::release(&xml_name);
-
-      if (index != -1) {
-         char* ascii = xercesc::XMLString::transcode(
-            my_attrs.getValue(index));
-
-         T result = xml_attr_cast<T>(ascii);
-
-         xercesc::XMLString::release(&ascii);
-         return result;
-      }
+      if (const char* value = find_value(a_name))
+         return xml_attr_cast<T>(value);
       else
          throw std::runtime_error("No attribute: " + a_name);
    }
@@ -122,11 +168,78 @@ public:
    template <class T>
    T get(const string& name, const T& def) const
    {
-      return has(name) ? get<T>(name) : def;
+      const char* value = find_value(name);
+      return value ? xml_attr_cast<T>(value) : def;
    }
 
 private:
-   const xercesc::Attributes& my_attrs;
+   // Compare the names directly rather than transcoding each one
+   static bool same_name(const XMLCh* xml_name, const string& name)
+   {
+      for (string::const_iterator it = name.begin();
+           it != name.end(); ++it, ++xml_name) {
+         if (*xml_name != static_cast<unsigned char>(*it))
+            return false;
+      }
+
+      return *xml_name == 0;
+   }
+
+   int find_index(const string& name) const
+   {
+      const XMLSize_t n = my_attrs->getLength();
+      for (XMLSize_t i = 0; i < n; i++) {
+         if (same_name(my_attrs->getQName(i), name))
+            return static_cast<int>(i);
+      }
+
+      return -1;
+   }
+
+   const string* find_pair(const string& name) const
+   {
+      for (Pairs::const_iterator it = my_pairs->begin();
+           it != my_pairs->end(); ++it) {
+         if (*(*it).first == name)
+            return (*it).second;
+      }
+      return NULL;
+   }
+
+   // The value is only valid until the next lookup
+   const char* find_value(const string& name) const
+   {
+      if (my_pairs) {
+         const string* value = find_pair(name);
+         return value ? value->c_str() : NULL;
+      }
+
+      const int index = find_index(name);
+      if (index == -1)
+         return NULL;
+
+      // Values are nearly always ASCII so copy them across directly
+      // and only use the transcoder for anything else
+      const XMLCh* xml_value = my_attrs->getValue(index);
+
+      my_buf->clear();
+      for (const XMLCh* p = xml_value; *p; ++p) {
+         if (*p >= 0x80) {
+            char* ascii = xercesc::XMLString::transcode(xml_value);
+            *my_buf = ascii;
+            xercesc::XMLString::release(&ascii);
+            break;
+         }
+
+         *my_buf += static_cast<char>(*p);
+      }
+
+      return my_buf->c_str();
+   }
+
+   const xercesc::Attributes* my_attrs;
+   const Pairs* my_pairs;
+   string* my_buf;
 };
 
 // SAX-like interface to XML parsing
@@ -138,9 +251,12 @@ struct IXMLCallback {
    virtual void end_element(const string& local_name) {}
    virtual void text(const string& local_name,
                      const string& a_string) {}
+
+   // Text is only collected for elements where this returns true
+   virtual bool wants_text(const string& local_name) const { return true; }
 };
 
-// Interface to a validating XML parser
+// Interface to an XML parser
 struct IXMLParser {
    virtual ~IXMLParser() {}
 
@@ -150,7 +266,17 @@ struct IXMLParser {
 
 typedef shared_ptr<IXMLParser> IXMLParserPtr;
 
+// Files are only checked against the schema when validation is on
+// Otherwise they are read by a faster non-validating parser which
+// should only be used for trusted content
 IXMLParserPtr make_xml_parser(const std::string& a_schema_file);
 
+// Affects parsers made after the call
+void set_xml_validation(bool on_off);
+bool xml_validation();
+
+// Non-validating parser which doesn't use Xerces
+IXMLParserPtr make_fast_xml_parser();
+
 #endif
 
@@ -0,0 +1,109 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef INC_LRU_CACHE_HPP
+#define INC_LRU_CACHE_HPP
+
+#include "Platform.hpp"
+
+#include <string>
+#include <list>
+#include <unordered_map>
+
+// Keeps loaded objects until their total cost goes over a budget then
+// throws away the ones used least recently. Anything still referred
+// to from outside the cache is pinned and never thrown away as the
+// memory wouldn't be freed anyway
+template <class T, class Key = string>
+class LRUCache {
+public:
+   LRUCache(size_t a_budget) : my_budget(a_budget), my_used(0) {}
+
+   // Returns null if the object isn't in the cache
+   shared_ptr<T> find(const Key& a_key)
+   {
+      typename IndexType::iterator it = my_index.find(a_key);
+      if (it == my_index.end())
+         return shared_ptr<T>();
+
+      // Move to the front as the most recently used
+      my_entries.splice(my_entries.begin(), my_entries, (*it).second);
+      return (*it).second->ptr;
+   }
+
+   void insert(const Key& a_key, shared_ptr<T> a_ptr, size_t a_cost)
+   {
+      typename IndexType::iterator it = my_index.find(a_key);
+      if (it != my_index.end())
+         erase((*it).second);
+
+      Entry e = { a_key, a_ptr, a_cost };
+      my_entries.push_front(e);
+      my_index[a_key] = my_entries.begin();
+      my_used += a_cost;
+
+      trim();
+   }
+
+   // Throw away unpinned objects until back under budget
+   void trim()
+   {
+      typename EntryList::iterator it = my_entries.end();
+      while (my_used > my_budget && it != my_entries.begin()) {
+         --it;
+         if ((*it).ptr.use_count() == 1)
+            erase(it++);
+      }
+   }
+
+   // Forget everything including pinned objects
+   void clear()
+   {
+      my_entries.clear();
+      my_index.clear();
+      my_used = 0;
+   }
+
+   void set_budget(size_t a_budget) { my_budget = a_budget; }
+
+   size_t used() const { return my_used; }
+   size_t size() const { return my_entries.size(); }
+
+private:
+   struct Entry {
+      Key key;
+      shared_ptr<T> ptr;
+      size_t cost;
+   };
+
+   typedef list<Entry> EntryList;
+   typedef unordered_map<Key, typename EntryList::iterator> IndexType;
+
+   void erase(typename EntryList::iterator it)
+   {
+      my_used -= (*it).cost;
+      my_index.erase((*it).key);
+      my_entries.erase(it);
+   }
+
+   size_t my_budget, my_used;
+   EntryList my_entries;   // Most recently used first
+   IndexType my_index;
+};
+
+#endif
@@ -19,10 +19,13 @@
 #define INC_MOVING_AVERAGE_HPP
 
 // Generic class to compute moving average of last N values
+// The samples are kept in a ring buffer and a running sum is updated
+// as each new value replaces the oldest so both operations are O(1)
 template <class T, int N>
 class MovingAverage {
 public:
    MovingAverage()
+      : my_next(0), my_sum(static_cast<T>(0))
    {
       for (int i = 0; i < N; i++)
          my_samples[i] = static_cast<T>(0);
@@ -30,22 +33,57 @@ public:
 
    T value() const
    {
-      T sum = static_cast<T>(0);
-      for (int i = 0; i < N; i++)
-         sum += my_samples[i];
-      
-      return sum / static_cast<T>(N);
+      return my_sum / static_cast<T>(N);
    }
 
    void operator<<(T a_value)
    {
-      for (int i = N - 1; i > 0; i--)
-         my_samples[i] = my_samples[i-1];
-      my_samples[0] = a_value;
+      my_sum += a_value - my_samples[my_next];
+      my_samples[my_next] = a_value;
+
+      if (++my_next == N) {
+         my_next = 0;
+
+         // Recompute the sum exactly once per trip around the buffer
+         // so rounding errors in the running sum cannot accumulate
+         // (Kahan compensation doesn't survive -ffast-math)
+         T sum = static_cast<T>(0);
+         for (int i = 0; i < N; i++)
+            sum += my_samples[i];
+         my_sum = sum;
+      }
    }
    
 private:
    T my_samples[N];
+   int my_next;
+   T my_sum;
+};
+
+// Exponentially weighted average with the same interface as
+// MovingAverage: use this where the window doesn't need to be exact
+// as it needs no sample storage. The smoothing factor 2/(N+1) gives
+// roughly the same lag as a MovingAverage over N samples
+template <class T, int N>
+class ExponentialAverage {
+public:
+   ExponentialAverage()
+      : my_value(static_cast<T>(0)) {}
+
+   T value() const
+   {
+      return my_value;
+   }
+
+   void operator<<(T a_value)
+   {
+      my_value += (a_value - my_value) * ALPHA;
+   }
+
+private:
+   T my_value;
+
+   static constexpr double ALPHA = 2.0 / (N + 1.0);
 };
 
 #endif
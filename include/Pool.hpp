@@ -0,0 +1,157 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_POOL_HPP
+#define INC_POOL_HPP
+
+#include "Platform.hpp"
+
+#include <new>
+#include <type_traits>
+#include <cstddef>
+
+// Hands out fixed size blocks carved from large chunks
+// Freed blocks go on a list to be reused so tearing down and loading a
+// map again doesn't go back to the system allocator
+// This is not thread safe: only use it from the main thread
+template <size_t Size, size_t Align>
+class FixedPool {
+   // Chunks come from operator new which only guarantees this much
+   static_assert(Align <= 16, "over-aligned pool type");
+
+public:
+   static void* allocate()
+   {
+      FixedPool& p = instance();
+
+      if (p.free_list == NULL)
+         p.grow();
+
+      Block* b = p.free_list;
+      p.free_list = b->next;
+      return b;
+   }
+
+   static void deallocate(void* ptr)
+   {
+      FixedPool& p = instance();
+
+      Block* b = static_cast<Block*>(ptr);
+      b->next = p.free_list;
+      p.free_list = b;
+   }
+
+private:
+   FixedPool() : free_list(NULL) {}
+
+   union Block {
+      Block* next;
+      typename aligned_storage<Size, Align>::type data;
+   };
+
+   static const size_t BLOCKS_PER_CHUNK = 256;
+
+   // Never destroyed as objects in other statics may still be
+   // returned to the pool during exit
+   static FixedPool& instance()
+   {
+      static FixedPool* pool = new FixedPool;
+      return *pool;
+   }
+
+   void grow()
+   {
+      Block* blocks = static_cast<Block*>(
+         ::operator new(sizeof(Block) * BLOCKS_PER_CHUNK));
+
+      for (size_t i = 0; i < BLOCKS_PER_CHUNK; i++) {
+         blocks[i].next = free_list;
+         free_list = &blocks[i];
+      }
+   }
+
+   Block* free_list;
+};
+
+// Allocator which takes single objects from the pool for their size
+// Use with allocate_shared so the object and its reference count live
+// in a single pool block
+template <class T>
+class PoolAllocator {
+public:
+   typedef T value_type;
+   typedef T* pointer;
+   typedef const T* const_pointer;
+   typedef T& reference;
+   typedef const T& const_reference;
+   typedef size_t size_type;
+   typedef ptrdiff_t difference_type;
+
+   template <class U>
+   struct rebind {
+      typedef PoolAllocator<U> other;
+   };
+
+   PoolAllocator() {}
+
+   template <class U>
+   PoolAllocator(const PoolAllocator<U>&) {}
+
+   pointer allocate(size_type n, const void* = 0)
+   {
+      if (n == 1)
+         return static_cast<pointer>(Pool::allocate());
+      else
+         return static_cast<pointer>(::operator new(n * sizeof(T)));
+   }
+
+   void deallocate(pointer p, size_type n)
+   {
+      if (n == 1)
+         Pool::deallocate(p);
+      else
+         ::operator delete(p);
+   }
+
+   size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+private:
+   typedef FixedPool<sizeof(T), alignment_of<T>::value> Pool;
+};
+
+// The pools are shared so any two allocators can free each other's memory
+template <class T, class U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+   return true;
+}
+
+template <class T, class U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+   return false;
+}
+
+// Create a shared object in a pool
+template <class T, class... Args>
+shared_ptr<T> make_pooled(Args&&... args)
+{
+   return allocate_shared<T>(PoolAllocator<T>(),
+                             std::forward<Args>(args)...);
+}
+
+#endif
@@ -0,0 +1,166 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_PRELOAD_HPP
+#define INC_PRELOAD_HPP
+
+#include "Platform.hpp"
+#include "ThreadPool.hpp"
+#include "IResource.hpp"
+#include "Maths.hpp"
+
+#include <string>
+#include <map>
+#include <set>
+
+// Models and images are decoded on a pool of loader threads while the
+// main thread gets on with something else. Anything which uses OpenGL
+// such as uploading textures is still done on the main thread when
+// the object is first loaded
+
+// Shared by everything loaded in the background
+ThreadPool& loader_pool();
+
+// Start decoding the models and textures of every building, tree,
+// engine and waggon
+void start_preloading();
+
+// Free anything decoded in the background which hasn't been used by
+// the time loading has finished
+void finish_preloading();
+
+// Find the model named in a resource's XML file and start decoding it
+// A <scale> element in the XML overrides a_scale if scale_from_xml
+void prefetch_resource_model(IResourcePtr a_res, float a_scale,
+                             Vector<float> shift,
+                             bool scale_from_xml = false);
+
+// Results of work started on the loader threads keyed by name
+// Each name is only ever decoded once either by start or because
+// take found nothing and the caller did it itself
+// Results nobody has taken yet count against a budget so the loader
+// threads can't fill memory with things that are never used
+template <class T>
+class PrefetchTable {
+public:
+   typedef size_t (*CostFunc)(const T&);
+   typedef void (*DisposeFunc)(T);
+
+   // The dispose function frees results which are never taken
+   explicit PrefetchTable(CostFunc a_cost, DisposeFunc a_dispose = NULL)
+      : cost(a_cost), dispose(a_dispose), budget(0), used(0),
+        closed(false)
+   {}
+
+   ~PrefetchTable() { clear(); }
+
+   // Returns false if the name has already been asked for or the
+   // budget is used up
+   bool start(const string& name, const function<T ()>& f)
+   {
+      lock_guard<mutex> lock(table_mutex);
+
+      if (closed || used.load() >= budget.load())
+         return false;
+
+      if (!requested.insert(name).second)
+         return false;
+
+      pending.insert(make_pair(name, loader_pool().submit(
+         function<T ()>(bind(&PrefetchTable::produce, this, f)))));
+      return true;
+   }
+
+   // Waits for the result if it was started in the background
+   // Otherwise returns false and the caller must produce it
+   bool take(const string& name, T& result)
+   {
+      ThreadPool::Job<T> job;
+      {
+         lock_guard<mutex> lock(table_mutex);
+
+         typename PendingMap::iterator it = pending.find(name);
+         if (it == pending.end()) {
+            requested.insert(name);
+            return false;
+         }
+
+         job = (*it).second;
+         pending.erase(it);
+      }
+
+      // Runs it here if it's still queued
+      result = job.get();
+      used -= cost(result);
+      return true;
+   }
+
+   // Throw away every result nobody has taken and don't start any more
+   void clear()
+   {
+      PendingMap unclaimed;
+      {
+         lock_guard<mutex> lock(table_mutex);
+         closed = true;
+         unclaimed.swap(pending);
+      }
+
+      for (typename PendingMap::iterator it = unclaimed.begin();
+           it != unclaimed.end(); ++it) {
+         if ((*it).second.cancel())
+            continue;
+
+         try {
+            T result = (*it).second.get();
+            used -= cost(result);
+            if (dispose)
+               dispose(result);
+         }
+         catch (const exception&) {
+            // Whoever loads it properly will report the error
+         }
+      }
+   }
+
+   void set_budget(size_t a_budget) { budget = a_budget; }
+
+   // Size of the results which have been produced but not taken
+   size_t outstanding() const { return used.load(); }
+
+private:
+   PrefetchTable(const PrefetchTable&);
+   PrefetchTable& operator=(const PrefetchTable&);
+
+   T produce(const function<T ()>& f)
+   {
+      T result = f();
+      used += cost(result);
+      return result;
+   }
+
+   typedef map<string, ThreadPool::Job<T> > PendingMap;
+   PendingMap pending;
+   set<string> requested;
+   mutex table_mutex;
+
+   CostFunc cost;
+   DisposeFunc dispose;
+   atomic<size_t> budget, used;
+   bool closed;
+};
+
+#endif
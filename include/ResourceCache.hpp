@@ -19,36 +19,36 @@
 #define INC_RESOURCE_CACHE_HPP
 
 #include <string>
-#include <map>
 
 #include "IResource.hpp"
+#include "LRUCache.hpp"
 
 // A generic cache for resources
+// Only the most recently used objects are kept so the models they
+// refer to can be freed once nothing on the map uses them
 template <class T>
 class ResourceCache {
 public:
    typedef function<T* (IResourcePtr)> LoaderType;
    
-   ResourceCache(LoaderType a_loader, const string& a_class)
-      : my_loader(a_loader), my_class(a_class) {}
+   ResourceCache(LoaderType a_loader, const string& a_class,
+                 size_t a_keep = 16)
+      : my_loader(a_loader), my_class(a_class), my_cache(a_keep) {}
 
    // Load one single copy of this object
    // -> use this if the object has no state
    shared_ptr<T> load(const string& a_res_id)
    {
-      typename CacheType::iterator it = my_cache.find(a_res_id);
-      if (it != my_cache.end())
-         return (*it).second;
-      else {
-         T* loaded = my_loader(find_resource(a_res_id, my_class));
-         shared_ptr<T> ptr(loaded);
-         my_cache[a_res_id] = ptr;
-         return ptr;
+      shared_ptr<T> ptr = my_cache.find(a_res_id);
+      if (!ptr) {
+         ptr.reset(my_loader(find_resource(a_res_id, my_class)));
+         my_cache.insert(a_res_id, ptr, 1);
       }
+      return ptr;
    }
 
    // Make a copy each time a new object is loaded but only
-   // parse the XML once
+   // parse the XML again if the original dropped out of the cache
    // -> use this if the object has state 
    shared_ptr<T> load_copy(const string& a_res_id)
    {
@@ -59,9 +59,9 @@ public:
 private:
    LoaderType my_loader;
    const string my_class;
-   
-   typedef map<string, shared_ptr<T> > CacheType;
-   CacheType my_cache;
+
+   // Each object costs one so the budget is a number of objects
+   LRUCache<T> my_cache;
 };
 
 #endif
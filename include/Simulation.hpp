@@ -0,0 +1,33 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_SIMULATION_HPP
+#define INC_SIMULATION_HPP
+
+#include "Platform.hpp"
+
+#include <string>
+
+#include <ostream>
+
+// Load a map and run a number of trains on it for a fixed number of
+// ticks without a window or OpenGL context. Prints the throughput, the
+// time spent in each phase, and a checksum of the final train states
+void run_simulation(const string& a_map_res, int a_trains, int a_ticks,
+                    ostream& a_report);
+
+#endif
@@ -0,0 +1,173 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_THREAD_POOL_HPP
+#define INC_THREAD_POOL_HPP
+
+#include "Platform.hpp"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <vector>
+
+// A fixed set of worker threads which run functions in the order they
+// were submitted
+// Asking for the result of a function no worker has started yet runs
+// it straight away on the calling thread rather than waiting for
+// everything queued in front of it. Anything still queued when the
+// pool is destroyed is only run if its result is asked for
+class ThreadPool {
+private:
+   // Whichever of a worker or the caller claims the task first runs it
+   template <class T>
+   struct Task {
+      Task(const function<T ()>& f) : run(f), claimed(false) {}
+
+      bool claim() { return !claimed.exchange(true); }
+
+      packaged_task<T ()> run;
+      atomic<bool> claimed;
+   };
+
+public:
+   template <class T>
+   class Job {
+   public:
+      Job() {}
+
+      Job(shared_ptr<Task<T> > a_task)
+         : task(a_task), result(a_task->run.get_future()) {}
+
+      // True once the result is available without waiting
+      bool ready() const
+      {
+         return result.wait_for(chrono::seconds(0)) == future_status::ready;
+      }
+
+      // Run the function here if no worker has started it then wait
+      // for it to finish
+      void wait() const
+      {
+         if (task->claim())
+            task->run();
+         result.wait();
+      }
+
+      // Rethrows any exception the function threw
+      T get() const
+      {
+         wait();
+         return result.get();
+      }
+
+      // Stop the function from ever running if no worker has started
+      // it. Returns false if it has been or is being run
+      bool cancel() const { return task->claim(); }
+
+   private:
+      shared_ptr<Task<T> > task;
+      shared_future<T> result;
+   };
+
+   explicit ThreadPool(unsigned n_threads)
+      : stopping(false)
+   {
+      for (unsigned i = 0; i < n_threads; i++)
+         workers.push_back(thread(&ThreadPool::work, this));
+   }
+
+   ~ThreadPool()
+   {
+      {
+         lock_guard<mutex> lock(queue_mutex);
+         stopping = true;
+         queue.clear();
+      }
+      ready.notify_all();
+
+      for (vector<thread>::iterator it = workers.begin();
+           it != workers.end(); ++it)
+         (*it).join();
+   }
+
+   template <class T>
+   Job<T> submit(const function<T ()>& f)
+   {
+      shared_ptr<Task<T> > task(new Task<T>(f));
+      Job<T> job(task);
+
+      {
+         lock_guard<mutex> lock(queue_mutex);
+         queue.push_back(Run<T>(task));
+      }
+      ready.notify_one();
+
+      return job;
+   }
+
+   unsigned size() const { return workers.size(); }
+
+private:
+   ThreadPool(const ThreadPool&);
+   ThreadPool& operator=(const ThreadPool&);
+
+   // Queued functions must be copyable but tasks aren't
+   template <class T>
+   struct Run {
+      Run(shared_ptr<Task<T> > t) : task(t) {}
+
+      void operator()()
+      {
+         if (task->claim())
+            task->run();
+      }
+
+      shared_ptr<Task<T> > task;
+   };
+
+   void work()
+   {
+      for (;;) {
+         function<void ()> next;
+         {
+            unique_lock<mutex> lock(queue_mutex);
+            while (!stopping && queue.empty())
+               ready.wait(lock);
+
+            if (stopping)
+               return;
+
+            next = queue.front();
+            queue.pop_front();
+         }
+
+         next();
+      }
+   }
+
+   vector<thread> workers;
+   deque<function<void ()> > queue;
+   mutex queue_mutex;
+   condition_variable ready;
+   bool stopping;
+};
+
+#endif
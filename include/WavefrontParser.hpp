@@ -0,0 +1,426 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef INC_WAVEFRONT_PARSER_HPP
+#define INC_WAVEFRONT_PARSER_HPP
+
+#include "Platform.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+#ifdef WIN32
+#include <fstream>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Single pass readers for WaveFront .obj and .mtl files
+// The whole file is mapped into memory and scanned once without
+// copying any of it except for names
+namespace wavefront {
+
+   // A file mapped read only into memory
+   class MappedFile {
+   public:
+      explicit MappedFile(const string& a_file_name)
+         : data(NULL), length(0)
+      {
+#ifdef WIN32
+         ifstream is(a_file_name.c_str(), ios::binary);
+         if (!is.good())
+            throw runtime_error("Failed to open " + a_file_name);
+
+         copy = vector<char>(istreambuf_iterator<char>(is),
+                             istreambuf_iterator<char>());
+         data = copy.empty() ? NULL : &copy[0];
+         length = copy.size();
+#else
+         const int fd = open(a_file_name.c_str(), O_RDONLY);
+         if (fd < 0)
+            throw runtime_error("Failed to open " + a_file_name);
+
+         struct stat st;
+         if (fstat(fd, &st) < 0) {
+            close(fd);
+            throw runtime_error("Failed to stat " + a_file_name);
+         }
+
+         length = st.st_size;
+
+         // Can't map an empty file
+         if (length > 0) {
+            void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+               close(fd);
+               throw runtime_error("Failed to map " + a_file_name);
+            }
+
+            data = static_cast<const char*>(p);
+         }
+
+         close(fd);
+#endif
+      }
+
+      ~MappedFile()
+      {
+#ifndef WIN32
+         if (data)
+            munmap(const_cast<char*>(data), length);
+#endif
+      }
+
+      const char* begin() const { return data; }
+      const char* end() const { return data + length; }
+      size_t size() const { return length; }
+
+   private:
+      MappedFile(const MappedFile&);
+      MappedFile& operator=(const MappedFile&);
+
+      const char* data;
+      size_t length;
+#ifdef WIN32
+      vector<char> copy;
+#endif
+   };
+
+   // Position in a file being read line by line
+   class Cursor {
+   public:
+      Cursor(const char* a_begin, const char* a_end,
+             const string& a_file_name)
+         : p(a_begin), end(a_end), line_(1), file_name(a_file_name)
+      {}
+
+      bool at_end() const { return p == end; }
+      unsigned line() const { return line_; }
+
+      // Skip spaces but not newlines
+      void skip_space()
+      {
+         while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            ++p;
+      }
+
+      // Move to the start of the next line
+      void next_line()
+      {
+         const void* nl = memchr(p, '\n', end - p);
+         if (nl) {
+            p = static_cast<const char*>(nl) + 1;
+            line_++;
+         }
+         else
+            p = end;
+      }
+
+      bool at_line_end()
+      {
+         skip_space();
+         return p == end || *p == '\n';
+      }
+
+      // The next run of non-space characters which may be empty
+      // Not copied so it is only valid while the file is
+      void word(const char*& a_begin, size_t& a_length)
+      {
+         skip_space();
+         a_begin = p;
+         while (p != end && !is_space(*p))
+            ++p;
+         a_length = p - a_begin;
+      }
+
+      string word()
+      {
+         const char* w;
+         size_t len;
+         word(w, len);
+         if (len == 0)
+            error("expected a name");
+         return string(w, len);
+      }
+
+      // Numbers without an exponent or more than nineteen significant
+      // digits are converted exactly apart from the final rounding
+      float number()
+      {
+         skip_space();
+         const char* start = p;
+
+         bool neg = false;
+         if (p != end && (*p == '-' || *p == '+'))
+            neg = (*p++ == '-');
+
+         unsigned long long mantissa = 0;
+         int exponent = 0, digits = 0;
+         bool any = false;
+
+         for (; p != end && is_digit(*p); ++p) {
+            add_digit(mantissa, exponent, digits, *p - '0');
+            any = true;
+         }
+
+         if (p != end && *p == '.') {
+            for (++p; p != end && is_digit(*p); ++p) {
+               if (add_digit(mantissa, exponent, digits, *p - '0'))
+                  exponent--;
+               any = true;
+            }
+         }
+
+         if (!any) {
+            p = start;
+            error("expected a number");
+         }
+
+         if (p != end && (*p == 'e' || *p == 'E')) {
+            const char* e = p + 1;
+            bool eneg = false;
+            if (e != end && (*e == '-' || *e == '+'))
+               eneg = (*e++ == '-');
+
+            if (e != end && is_digit(*e)) {
+               int n = 0;
+               for (; e != end && is_digit(*e); ++e)
+                  n = min(n * 10 + (*e - '0'), 1000);
+               exponent += eneg ? -n : n;
+               p = e;
+            }
+         }
+
+         double value = static_cast<double>(mantissa);
+         if (exponent > 0)
+            value *= power_of_ten(exponent);
+         else if (exponent < 0)
+            value /= power_of_ten(-exponent);
+
+         return static_cast<float>(neg ? -value : value);
+      }
+
+      // A positive face index or zero if it was left out
+      unsigned index()
+      {
+         unsigned n = 0;
+         for (; p != end && is_digit(*p); ++p)
+            n = n * 10 + (*p - '0');
+         return n;
+      }
+
+      // Consume the character if it's next
+      bool accept(char c)
+      {
+         if (p != end && *p == c) {
+            ++p;
+            return true;
+         }
+         else
+            return false;
+      }
+
+      void error(const string& what) const
+      {
+         ostringstream ss;
+         ss << file_name << ":" << line_ << ": " << what;
+         throw runtime_error(ss.str());
+      }
+
+   private:
+      static bool is_space(char c)
+      {
+         return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+      }
+
+      static bool is_digit(char c)
+      {
+         return c >= '0' && c <= '9';
+      }
+
+      // Returns false if the digit was too insignificant to keep
+      static bool add_digit(unsigned long long& mantissa, int& exponent,
+                            int& digits, int d)
+      {
+         if (digits < 19) {
+            mantissa = mantissa * 10 + d;
+            if (mantissa > 0)
+               digits++;
+            return true;
+         }
+         else {
+            exponent++;
+            return false;
+         }
+      }
+
+      static double power_of_ten(int n)
+      {
+         // Every power up to 22 is exact in a double
+         static const double table[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+            1e20, 1e21, 1e22
+         };
+
+         double r = 1.0;
+         for (; n > 22; n -= 22)
+            r *= table[22];
+         return r * table[n];
+      }
+
+      const char* p;
+      const char* const end;
+      unsigned line_;
+      const string& file_name;
+   };
+
+   inline bool is_keyword(const char* w, size_t len, const char* keyword)
+   {
+      return strlen(keyword) == len && memcmp(w, keyword, len) == 0;
+   }
+
+   // One corner of a face as one-based indices with zero for missing
+   struct FaceVertex {
+      unsigned v, vt, vn;
+   };
+
+   // Reads an .obj file calling the handler for each statement
+   // The handler needs these members:
+   //   void material_lib(const string& file_name)
+   //   void use_material(const string& name)
+   //   void vertex(float x, float y, float z)
+   //   void normal(float x, float y, float z)
+   //   void tex_coord(float u, float v)
+   //   void face(const FaceVertex* corners, unsigned n, unsigned line)
+   // Faces must have a normal on every corner and may have a texture
+   // coordinate: v//vn or v/vt/vn
+   template <class Handler>
+   void parse_obj(const char* begin, const char* end,
+                  const string& a_file_name, Handler& handler)
+   {
+      Cursor c(begin, end, a_file_name);
+      vector<FaceVertex> corners;
+
+      for (; !c.at_end(); c.next_line()) {
+         const char* w;
+         size_t len;
+         c.word(w, len);
+
+         if (len == 0 || *w == '#')
+            continue;
+         else if (is_keyword(w, len, "v")) {
+            const float x = c.number();
+            const float y = c.number();
+            const float z = c.number();
+            handler.vertex(x, y, z);
+         }
+         else if (is_keyword(w, len, "vn")) {
+            const float x = c.number();
+            const float y = c.number();
+            const float z = c.number();
+            handler.normal(x, y, z);
+         }
+         else if (is_keyword(w, len, "vt")) {
+            const float u = c.number();
+            const float v = c.number();
+            handler.tex_coord(u, v);
+         }
+         else if (is_keyword(w, len, "f")) {
+            corners.clear();
+
+            while (!c.at_line_end()) {
+               FaceVertex fv;
+               fv.v = c.index();
+               if (fv.v == 0 || !c.accept('/'))
+                  c.error("face vertices must be v//vn or v/vt/vn");
+
+               fv.vt = c.index();
+               if (!c.accept('/') || (fv.vn = c.index()) == 0)
+                  c.error("face vertices must have a normal");
+
+               corners.push_back(fv);
+            }
+
+            if (corners.empty())
+               c.error("face with no vertices");
+
+            handler.face(&corners[0], corners.size(), c.line());
+         }
+         else if (is_keyword(w, len, "usemtl"))
+            handler.use_material(c.word());
+         else if (is_keyword(w, len, "mtllib"))
+            handler.material_lib(c.word());
+
+         // Anything else such as objects and groups is ignored
+      }
+   }
+
+   // Reads an .mtl file calling the handler for each statement
+   // The handler needs these members:
+   //   void new_material(const string& name)
+   //   void diffuse(float r, float g, float b)
+   //   void ambient(float r, float g, float b)
+   //   void specular(float r, float g, float b)
+   //   void diffuse_map(const string& file_name)
+   template <class Handler>
+   void parse_mtl(const char* begin, const char* end,
+                  const string& a_file_name, Handler& handler)
+   {
+      Cursor c(begin, end, a_file_name);
+
+      for (; !c.at_end(); c.next_line()) {
+         const char* w;
+         size_t len;
+         c.word(w, len);
+
+         if (len == 0 || *w == '#')
+            continue;
+         else if (is_keyword(w, len, "newmtl"))
+            handler.new_material(c.word());
+         else if (is_keyword(w, len, "Kd")) {
+            const float r = c.number();
+            const float g = c.number();
+            const float b = c.number();
+            handler.diffuse(r, g, b);
+         }
+         else if (is_keyword(w, len, "Ka")) {
+            const float r = c.number();
+            const float g = c.number();
+            const float b = c.number();
+            handler.ambient(r, g, b);
+         }
+         else if (is_keyword(w, len, "Ks")) {
+            const float r = c.number();
+            const float g = c.number();
+            const float b = c.number();
+            handler.specular(r, g, b);
+         }
+         else if (is_keyword(w, len, "map_Kd"))
+            handler.diffuse_map(c.word());
+      }
+   }
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <ostream>
+#include <vector>
 
 #include <boost/lexical_cast.hpp>
 
@@ -45,10 +46,10 @@ namespace xml {
                "Cannot add XML attributes after children");
          else {
             ostringstream ss;
-            ss << boolalpha;
-            ss << " " << name << "=\"" << t << "\"";
-            
-            str += ss.str();
+            ss << boolalpha << t;
+
+            str += " " + name + "=\"" + ss.str() + "\"";
+            attributes.push_back(make_pair(name, ss.str()));
          }
 
          return *this;
@@ -84,6 +85,9 @@ namespace xml {
 
       bool has_children;
       string str, name;
+
+      // Formatted values of the attributes in order
+      vector<pair<string, string> > attributes;
    };
 
    struct document {
@@ -91,6 +95,96 @@ namespace xml {
 
       const element& root;
    };
+
+   // Writes elements straight to a stream as they are generated rather
+   // than building the whole tree in memory first
+   // The output is identical to printing the equivalent document
+   class writer {
+   public:
+      writer(ostream& os)
+         : os(os)
+      {
+         os << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl;
+         attr << boolalpha;
+      }
+
+      writer& begin(const string& name)
+      {
+         if (!open.empty())
+            start_child() << "\n";
+
+         os << "<" << name;
+
+         frame f = { name, false };
+         open.push_back(f);
+         return *this;
+      }
+
+      template <class T>
+      writer& add_attribute(const string& name, T t)
+      {
+         if (open.empty() || open.back().has_children)
+            throw runtime_error(
+               "Cannot add XML attributes after children");
+
+         // Format exactly as element does
+         attr.str("");
+         attr << " " << name << "=\"" << t << "\"";
+         os << attr.str();
+
+         return *this;
+      }
+
+      writer& add_text(const string& text)
+      {
+         start_child() << text;
+         return *this;
+      }
+
+      // Write a complete element built in memory
+      writer& add_child(const element& e)
+      {
+         start_child() << "\n" << e.finish();
+         return *this;
+      }
+
+      writer& end()
+      {
+         if (open.empty())
+            throw runtime_error("No XML element to end");
+
+         if (open.back().has_children)
+            os << "</" << open.back().name << ">\n";
+         else
+            os << "/>\n";
+
+         open.pop_back();
+         return *this;
+      }
+
+   private:
+      ostream& start_child()
+      {
+         if (open.empty())
+            throw runtime_error("XML content outside root element");
+
+         if (!open.back().has_children) {
+            os << ">";
+            open.back().has_children = true;
+         }
+
+         return os;
+      }
+
+      struct frame {
+         string name;
+         bool has_children;
+      };
+
+      ostream& os;
+      vector<frame> open;
+      ostringstream attr;
+   };
 };
 
 inline std::ostream& operator<<(std::ostream& os, const xml::document& doc)
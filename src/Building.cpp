@@ -18,6 +18,7 @@
 #include "IScenery.hpp"
 #include "IResource.hpp"
 #include "ResourceCache.hpp"
+#include "Preload.hpp"
 #include "ILogger.hpp"
 #include "IXMLParser.hpp"
 #include "XMLBuilder.hpp"
@@ -46,6 +47,12 @@ public:
    void start_element(const string& local_name,
                       const AttributeSet& attrs);
 
+   // Models are centred on the tile
+   static Vector<float> model_shift()
+   {
+      return -make_vector(0.5f, 0.0f, 0.5f);
+   }
+
 private:
    static CargoType cargo_from_xml(const AttributeSet& attrs);
       
@@ -70,9 +77,8 @@ Building::Building(IResourcePtr a_res)
    parser_state = new ParserState;   
    parser->parse(a_res->xml_file_name(), *this);
 
-   Vector<float> shift = -make_vector(0.5f, 0.0f, 0.5f);
    model_ = load_model(a_res, parser_state->model_file,
-                       1.0f, shift);
+                       1.0f, model_shift());
    industry_ = make_industry(parser_state->produces, parser_state->consumes);
    
    delete parser_state;
@@ -171,3 +177,8 @@ ISceneryPtr load_building(const AttributeSet& attrs)
 
    return load_building(name, angle);
 }
+
+void prefetch_building(IResourcePtr a_res)
+{
+   prefetch_resource_model(a_res, 1.0f, Building::model_shift());
+}
@@ -39,6 +39,10 @@ namespace {
       Default("YRes", 600),
       Default("NearClip", 0.1f),
       Default("FarClip", 70.0f),
+      Default("ValidateXML", false),
+      Default("CompressHeightMap", true),
+      Default("ModelCacheMB", 64),
+      Default("TextureCacheMB", 64),
    };
 }
 
@@ -56,6 +60,7 @@ public:
    // IXMLCallback interface
    void start_element(const string& local_name, const AttributeSet& attrs);
    void text(const string& local_name, const string& a_string);
+   bool wants_text(const string& local_name) const;
 
 private:
    static boost::filesystem::path config_file_name();
@@ -119,6 +124,12 @@ void Config::start_element(const string& local_name, const AttributeSet& attrs)
       attrs.get("name", my_active_option);
 }
 
+bool Config::wants_text(const string& local_name) const
+{
+   return local_name == "string" || local_name == "int"
+      || local_name == "bool" || local_name == "float";
+}
+
 void Config::text(const string& local_name, const string& a_string)
 {
    if (local_name == "string")
@@ -20,13 +20,13 @@
 #include "XMLBuilder.hpp"
 #include "ILogger.hpp"
 #include "OpenGLHelper.hpp"
+#include "Pool.hpp"
 
 #include <stdexcept>
 #include <cassert>
 
 #include <boost/lexical_cast.hpp>
 
-using namespace placeholders;
 using namespace boost;
 
 // A section of track that allows travelling along both axis
@@ -46,6 +46,11 @@ public:
    float segment_length(const track::TravelToken& a_token) const;
    bool is_valid_direction(const track::Direction& a_direction) const;
    track::Connection next_position(const track::TravelToken& a_token) const;
+   void get_exits(const track::TravelToken& a_token,
+                  vector<track::Connection>& exits) const
+   {
+      exits.push_back(next_position(a_token));
+   }
    void get_endpoints(vector<Point<int> >& a_list) const;
    void get_covers(vector<Point<int> >& output) const { }
    void get_height_locked(vector<Point<int> >& output) const;
@@ -65,6 +70,13 @@ private:
    
    Point<int> origin;
    float height;
+
+   static const track::TrackShape shape;
+};
+
+const track::TrackShape CrossoverTrack::shape = {
+   track::transform_member<CrossoverTrack, &CrossoverTrack::transform>,
+   track::flat_gradient_func
 };
 
 void CrossoverTrack::merge(IMeshBufferPtr buf) const
@@ -126,8 +138,9 @@ CrossoverTrack::get_travel_token(track::Position a_position,
    track::TravelToken tok = {
       a_direction,
       a_position,
-      bind(&CrossoverTrack::transform, this, _1, _2),
-      track::flat_gradient_func,
+      this,
+      &shape,
+      0,
       1
    };
    return tok;
@@ -215,5 +228,5 @@ xml::element CrossoverTrack::to_xml() const
 
 ITrackSegmentPtr make_crossover_track()
 {
-   return ITrackSegmentPtr(new CrossoverTrack);
+   return make_pooled<CrossoverTrack>();
 }
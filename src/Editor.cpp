@@ -84,6 +84,7 @@ private:
    void delete_objects();
    void plant_trees();
    void save();
+   void update_save();
    bool is_diagonal(const track::Direction& dir) const;
 
    IMapPtr map;
@@ -102,6 +103,9 @@ private:
    gui::ILayoutPtr layout;
    ISceneryPickerPtr building_picker, tree_picker;
    IRenderStatsPtr render_stats;
+
+   // Save running in the background, if any
+   IMapSavePtr pending_save;
 };
 
 Editor::Editor(IMapPtr a_map)
@@ -167,7 +171,35 @@ void Editor::set_map(IMapPtr a_map)
 
 void Editor::save()
 {
-   map->save();
+   if (pending_save) {
+      warn() << "Already saving";
+      return;
+   }
+
+   pending_save = map->save_in_background();
+   update_save();
+}
+
+// Show how far the save has got and forget it once it's finished
+void Editor::update_save()
+{
+   gui::Label& label =
+      layout->cast<gui::Label>("/lower/action_wnd/save_label");
+
+   try {
+      if (pending_save->done()) {
+         label.text("Saved");
+         pending_save.reset();
+      }
+      else
+         label.format("Saving %d%%",
+                      static_cast<int>(pending_save->progress() * 100.0f));
+   }
+   catch (const exception& e) {
+      error() << "Failed to save map: " << e.what();
+      label.text("Save failed");
+      pending_save.reset();
+   }
 }
 
 // Calculate the bounds of the drag box accounting for the different
@@ -224,6 +256,9 @@ void Editor::overlay() const
 void Editor::update(IPickBufferPtr pick_buffer, int a_delta)
 {
    render_stats->update(a_delta);
+
+   if (pending_save)
+      update_save();
 }
 
 // True if the `a_first_point' is a valid track segment and it can
@@ -21,6 +21,7 @@
 #include "MovingAverage.hpp"
 #include "IXMLParser.hpp"
 #include "ResourceCache.hpp"
+#include "Preload.hpp"
 
 #include <GL/gl.h>
 
@@ -61,6 +62,7 @@ public:
    // IRollingStock interface
    void render() const;
    void update(int delta, double gravity);
+   bool powered() const { return true; }
 
    double speed() const { return my_speed; }
    double mass() const { return my_mass; }
@@ -79,6 +81,8 @@ public:
 
    // IXMLCallback interface
    void text(const string& local_name, const string& a_string);
+
+   static const float MODEL_SCALE;
 private:
    double tractive_effort() const;
    double resistance() const;
@@ -98,7 +102,6 @@ private:
 
    IResourcePtr resource;
 
-   static const float MODEL_SCALE;
    static const double TRACTIVE_EFFORT_KNEE;
 
    static const double INIT_PRESSURE, INIT_TEMP;
@@ -268,3 +271,9 @@ IRollingStockPtr load_engine(const string& a_res_id)
    static ResourceCache<Engine> cache(load_engine_xml, "engines");
    return cache.load_copy(a_res_id);
 }
+
+void prefetch_engine(IResourcePtr a_res)
+{
+   prefetch_resource_model(a_res, Engine::MODEL_SCALE,
+                           make_vector(0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,466 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "IXMLParser.hpp"
+#include "ILogger.hpp"
+
+#include <stdexcept>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+// Non-validating XML parser for files we trust such as the ones
+// shipped with the game. Only the parts of XML used by those files
+// are supported: elements, attributes, text, CDATA, character and
+// the predefined entity references. Comments, processing instructions
+// and document type declarations are skipped
+class FastXMLParser : public IXMLParser {
+public:
+   void parse(const string& a_file_name, IXMLCallback& a_callback);
+
+private:
+   void reset(const string& a_file_name, IXMLCallback& a_callback);
+   void parse_document();
+   void parse_start_tag();
+   void parse_end_tag();
+   void parse_text();
+   void parse_cdata();
+   void skip_past(const char* terminator);
+   void skip_doctype();
+   void skip_space();
+   void read_name(string& name);
+   void read_attribute_value(string& value);
+   void read_reference(string& out);
+   void end_element();
+   bool looking_at(const char* str) const;
+   void fail(const string& what) const;
+
+   // Each element which hasn't been closed yet
+   struct Frame {
+      string name;
+      bool wants_text, has_children;
+   };
+
+   string file_name;
+   IXMLCallback* callback;
+   vector<char> buf;
+   const char* pos;
+   const char* end;
+
+   // These keep their storage between elements and files
+   vector<Frame> open;
+   size_t depth;
+   string name, text;
+   vector<string> attr_names, attr_values;
+   AttributeSet::Pairs pairs;
+   bool seen_root;
+};
+
+namespace {
+
+   bool is_space(char c)
+   {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+   }
+
+   void append_utf8(string& out, unsigned c)
+   {
+      if (c < 0x80) {
+         out += static_cast<char>(c);
+         return;
+      }
+      else if (c < 0x800)
+         out += static_cast<char>(0xC0 | (c >> 6));
+      else if (c < 0x10000) {
+         out += static_cast<char>(0xE0 | (c >> 12));
+         out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      }
+      else {
+         out += static_cast<char>(0xF0 | (c >> 18));
+         out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+         out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      }
+      out += static_cast<char>(0x80 | (c & 0x3F));
+   }
+
+   // Callbacks are given the name without any namespace prefix
+   // like Xerces does
+   string local_part(const string& name)
+   {
+      const size_t colon = name.find(':');
+      return colon == string::npos ? name : name.substr(colon + 1);
+   }
+}
+
+void FastXMLParser::parse(const string& a_file_name, IXMLCallback& a_callback)
+{
+   reset(a_file_name, a_callback);
+
+   ifstream is(a_file_name.c_str(), ios::binary);
+   if (!is.good())
+      fail("cannot open file");
+
+   is.seekg(0, ios::end);
+   buf.resize(is.tellg());
+   is.seekg(0, ios::beg);
+
+   if (!buf.empty())
+      is.read(&buf[0], buf.size());
+
+   if (!is.good())
+      fail("cannot read file");
+
+   pos = buf.empty() ? NULL : &buf[0];
+   end = pos + buf.size();
+
+   parse_document();
+
+   callback = NULL;
+}
+
+void FastXMLParser::reset(const string& a_file_name,
+                          IXMLCallback& a_callback)
+{
+   file_name = a_file_name;
+   callback = &a_callback;
+   pos = end = NULL;
+   depth = 0;
+   seen_root = false;
+}
+
+void FastXMLParser::parse_document()
+{
+   // Skip any UTF-8 byte order mark
+   if (looking_at("\xEF\xBB\xBF"))
+      pos += 3;
+
+   while (pos < end) {
+      if (*pos != '<')
+         parse_text();
+      else if (looking_at("<?"))
+         skip_past("?>");
+      else if (looking_at("<!--"))
+         skip_past("-->");
+      else if (looking_at("<![CDATA["))
+         parse_cdata();
+      else if (looking_at("<!"))
+         skip_doctype();
+      else if (looking_at("</"))
+         parse_end_tag();
+      else
+         parse_start_tag();
+   }
+
+   if (depth > 0)
+      fail("missing end tag for " + open[depth - 1].name);
+   else if (!seen_root)
+      fail("no root element");
+}
+
+void FastXMLParser::parse_start_tag()
+{
+   if (depth == 0 && seen_root)
+      fail("more than one root element");
+
+   ++pos;   // Skip <
+   read_name(name);
+
+   // Read the attributes into strings kept from last time
+   size_t n_attrs = 0;
+   for (;;) {
+      skip_space();
+
+      if (pos >= end)
+         fail("unexpected end of file in tag");
+      else if (*pos == '>' || looking_at("/>"))
+         break;
+
+      if (n_attrs == attr_names.size()) {
+         attr_names.push_back(string());
+         attr_values.push_back(string());
+      }
+
+      read_name(attr_names[n_attrs]);
+
+      skip_space();
+      if (pos >= end || *pos != '=')
+         fail("expected = after attribute " + attr_names[n_attrs]);
+      ++pos;
+      skip_space();
+
+      read_attribute_value(attr_values[n_attrs]);
+      n_attrs++;
+   }
+
+   pairs.clear();
+   for (size_t i = 0; i < n_attrs; i++)
+      pairs.push_back(make_pair(&attr_names[i], &attr_values[i]));
+
+   if (depth > 0)
+      open[depth - 1].has_children = true;
+
+   if (depth == open.size())
+      open.push_back(Frame());
+
+   Frame& f = open[depth++];
+   f.name = name;
+   f.has_children = false;
+
+   const string local_name = local_part(name);
+   callback->start_element(local_name, AttributeSet(pairs));
+   f.wants_text = callback->wants_text(local_name);
+
+   seen_root = true;
+   text.clear();
+
+   if (*pos == '/') {
+      pos += 2;
+      end_element();
+   }
+   else
+      ++pos;
+}
+
+void FastXMLParser::parse_end_tag()
+{
+   pos += 2;   // Skip </
+   read_name(name);
+   skip_space();
+
+   if (pos >= end || *pos != '>')
+      fail("expected > after end tag " + name);
+   ++pos;
+
+   if (depth == 0)
+      fail("unexpected end tag " + name);
+   else if (name != open[depth - 1].name)
+      fail("end tag " + name + " does not match "
+           + open[depth - 1].name);
+
+   end_element();
+}
+
+void FastXMLParser::end_element()
+{
+   const Frame& f = open[depth - 1];
+   const string local_name = local_part(f.name);
+
+   // None of the schemas allow mixed content so text between child
+   // elements is just whitespace which Xerces wouldn't report either
+   if (f.wants_text && !f.has_children && !text.empty())
+      callback->text(local_name, text);
+
+   text.clear();
+   callback->end_element(local_name);
+
+   depth--;
+}
+
+void FastXMLParser::parse_text()
+{
+   const bool wanted = depth > 0 && open[depth - 1].wants_text;
+
+   while (pos < end && *pos != '<') {
+      if (depth == 0 && !is_space(*pos))
+         fail("text outside the root element");
+
+      if (*pos == '&') {
+         if (wanted)
+            read_reference(text);
+         else
+            skip_past(";");
+      }
+      else if (*pos == '\r') {
+         // Line endings are normalised to a single \n
+         if (wanted && (pos + 1 == end || pos[1] != '\n'))
+            text += '\n';
+         ++pos;
+      }
+      else {
+         const char* start = pos;
+         while (pos < end && *pos != '<' && *pos != '&' && *pos != '\r')
+            ++pos;
+
+         if (depth == 0) {
+            for (const char* p = start; p < pos; ++p) {
+               if (!is_space(*p))
+                  fail("text outside the root element");
+            }
+         }
+         else if (wanted)
+            text.append(start, pos);
+      }
+   }
+}
+
+void FastXMLParser::parse_cdata()
+{
+   pos += strlen("<![CDATA[");
+
+   const char* start = pos;
+   skip_past("]]>");
+
+   if (depth == 0)
+      fail("CDATA outside the root element");
+   else if (open[depth - 1].wants_text)
+      text.append(start, pos - 3);
+}
+
+void FastXMLParser::read_attribute_value(string& value)
+{
+   if (pos >= end || (*pos != '"' && *pos != '\''))
+      fail("expected quoted attribute value");
+
+   const char quote = *pos++;
+
+   value.clear();
+   while (pos < end && *pos != quote) {
+      if (*pos == '&')
+         read_reference(value);
+      else if (*pos == '<')
+         fail("< in attribute value");
+      else if (is_space(*pos)) {
+         // Normalised as the XML specification requires
+         if (!(*pos == '\r' && pos + 1 < end && pos[1] == '\n'))
+            value += ' ';
+         ++pos;
+      }
+      else
+         value += *pos++;
+   }
+
+   if (pos >= end)
+      fail("unterminated attribute value");
+   ++pos;
+}
+
+void FastXMLParser::read_reference(string& out)
+{
+   const char* start = ++pos;   // Skip &
+   while (pos < end && *pos != ';')
+      ++pos;
+
+   if (pos >= end)
+      fail("unterminated entity reference");
+
+   const string ref(start, pos++);
+
+   if (ref == "lt")
+      out += '<';
+   else if (ref == "gt")
+      out += '>';
+   else if (ref == "amp")
+      out += '&';
+   else if (ref == "quot")
+      out += '"';
+   else if (ref == "apos")
+      out += '\'';
+   else if (ref.size() > 1 && ref[0] == '#') {
+      const bool hex = ref[1] == 'x';
+      const char* digits = ref.c_str() + (hex ? 2 : 1);
+
+      char* digits_end;
+      const unsigned long c = strtoul(digits, &digits_end, hex ? 16 : 10);
+
+      if (digits_end == digits || *digits_end != '\0' || c == 0
+          || c > 0x10FFFF)
+         fail("bad character reference &" + ref + ";");
+
+      append_utf8(out, c);
+   }
+   else
+      fail("unknown entity &" + ref + ";");
+}
+
+void FastXMLParser::read_name(string& out)
+{
+   const char* start = pos;
+   while (pos < end && !is_space(*pos) && *pos != '>' && *pos != '/'
+          && *pos != '=' && *pos != '<')
+      ++pos;
+
+   if (pos == start)
+      fail("expected a name");
+
+   out.assign(start, pos);
+}
+
+void FastXMLParser::skip_space()
+{
+   while (pos < end && is_space(*pos))
+      ++pos;
+}
+
+void FastXMLParser::skip_past(const char* terminator)
+{
+   const size_t len = strlen(terminator);
+
+   while (pos < end && !looking_at(terminator))
+      ++pos;
+
+   if (pos >= end)
+      fail(string("missing ") + terminator);
+
+   pos += len;
+}
+
+// Skip a document type declaration including any internal subset
+void FastXMLParser::skip_doctype()
+{
+   int brackets = 0;
+   for (; pos < end; ++pos) {
+      if (*pos == '[')
+         brackets++;
+      else if (*pos == ']')
+         brackets--;
+      else if (*pos == '>' && brackets == 0) {
+         ++pos;
+         return;
+      }
+   }
+
+   fail("unterminated declaration");
+}
+
+bool FastXMLParser::looking_at(const char* str) const
+{
+   const size_t len = strlen(str);
+   return static_cast<size_t>(end - pos) >= len
+      && memcmp(pos, str, len) == 0;
+}
+
+void FastXMLParser::fail(const string& what) const
+{
+   int line = 1;
+   if (!buf.empty()) {
+      for (const char* p = &buf[0]; p < pos && p < end; ++p) {
+         if (*p == '\n')
+            line++;
+      }
+   }
+
+   error() << "XML error: " << what;
+   error() << "At " << file_name << " line " << line;
+
+   throw runtime_error("Failed to load XML file");
+}
+
+IXMLParserPtr make_fast_xml_parser()
+{
+   return IXMLParserPtr(new FastXMLParser);
+}
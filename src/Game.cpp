@@ -24,7 +24,8 @@
 #include "ILight.hpp"
 #include "GameScreens.hpp"
 #include "IBillboard.hpp"
-#include "IterateTrack.hpp"
+#include "ISmokeTrail.hpp"
+#include "ITrackEvents.hpp"
 #include "IConfig.hpp"
 #include "IMessageArea.hpp"
 #include "IRenderStats.hpp"
@@ -64,6 +65,7 @@ private:
 
    IMapPtr map;
    ITrainPtr train;
+   ITrackEventsPtr track_events;
    ILightPtr sun;
 
    // Station the train is either approaching or stopped at
@@ -93,6 +95,7 @@ Game::Game(IMapPtr a_map)
      panning(false)
 {
    train = make_train(map);
+   track_events = make_track_events(map);
    sun = make_sun_light();
 
    map->set_grid(false);
@@ -150,6 +153,7 @@ void Game::display(IGraphicsPtr a_context) const
    train->render();
 
    render_billboards();
+   render_smoke_trails();
 }
 
 void Game::overlay() const
@@ -235,48 +239,41 @@ void Game::left_station()
 // that they are approaching
 void Game::look_ahead()
 {
-   TrackIterator it = iterate_track(map, train->tile(),
-      train->direction());
+   const track::Connection here =
+      make_pair(train->tile(), train->direction());
 
    // Are we sitting on a station?
-   if (it.status == TRACK_STATION) {
-      near_station(it.station);
+   const TrackEvent& current = track_events->next_event(here);
+   if (current.segments == 0 && current.status == TRACK_STATION) {
+      near_station(current.station);
 
       if (train->controller()->stopped())
          stopped_at_station();
       else
-         message_area->post("Stop here for station " + it.station->name());
+         message_area->post("Stop here for station "
+                            + current.station->name());
 
       return;
    }
 
-   const int max_look = 10;
-   for (int i = 0; i < max_look; i++) {
-      it = it.next();
-
-      if (it.status != TRACK_OK) {
-         bool clear_station = true;
-
-         switch (it.status) {
-         case TRACK_STATION:
-            message_area->post("Approaching station " + it.station->name());
-            near_station(it.station);
-            clear_station = false;
-            return;
-         case TRACK_NO_MORE:
-            message_area->post("Oh no! You're going to crash!");
-            break;
-         case TRACK_CHOICE:
-            message_area->post("Oh no! You have to make a decision!");
-            it.track->set_state_render_hint();
-            break;
-         default:
-            break;
-         }
+   const unsigned max_look = 10;
+   const TrackEvent ahead = track_events->following_event(here);
 
-         if (!clear_station)
-            left_station();
+   if (ahead.segments <= max_look) {
+      switch (ahead.status) {
+      case TRACK_STATION:
+         message_area->post("Approaching station " + ahead.station->name());
+         near_station(ahead.station);
+         return;
+      case TRACK_NO_MORE:
+         message_area->post("Oh no! You're going to crash!");
+         return;
+      case TRACK_CHOICE:
+         message_area->post("Oh no! You have to make a decision!");
+         ahead.track->set_state_render_hint();
          return;
+      default:
+         break;
       }
    }
 
@@ -52,17 +52,8 @@ TrackIterator iterate_track(IMapPtr a_map, track::Position a_position,
    }
 
    // Are we sitting on a station?
-   typedef vector<Point<int> > PointList;
-   PointList endpoints;
-   it.track->get_endpoints(endpoints);
-
-   IStationPtr station;
-   for (PointList::const_iterator p = endpoints.begin();
-        p != endpoints.end(); ++p)
-      if ((it.station = a_map->station_at(make_point((*p).x, (*p).y)))) {
-         it.status = TRACK_STATION;
-         break;
-      }
+   if ((it.station = a_map->station_on_track(a_position)))
+      it.status = TRACK_STATION;
 
    if (it.token.num_exits > 1) {
        assert(it.track->has_multiple_states());
@@ -21,6 +21,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 
 #ifdef WIN32
 #include <io.h>   // For _isatty
@@ -41,6 +42,9 @@ public:
 
 namespace {
    bool is_stdoutTTY;
+
+   // Held while a whole line is written out
+   mutex output_mutex;
 }
 
 LoggerImpl::LoggerImpl()
@@ -61,44 +65,48 @@ LoggerImpl::LoggerImpl()
 
 PrintLinePtr LoggerImpl::write_msg(LogMsgType type)
 {
+   PrintLinePtr line(new PrintLine(cout));
+   ostream& out = line->stream;
+
    if (is_stdoutTTY)
-      cout << "\x1B[1m";
+      out << "\x1B[1m";
 
    switch (type) {
    case LOG_NORMAL:
-      cout << "[INFO ] ";
+      out << "[INFO ] ";
       break;
    case LOG_DEBUG:
       if (is_stdoutTTY)
-         cout << "\x1B[36m";
-      cout << "[DEBUG] ";
+         out << "\x1B[36m";
+      out << "[DEBUG] ";
       break;
    case LOG_WARN:
       if (is_stdoutTTY)
-         cout << "\x1B[33m";
-      cout << "[WARN ] ";
+         out << "\x1B[33m";
+      out << "[WARN ] ";
       break;
    case LOG_ERROR:
       if (is_stdoutTTY)
-         cout << "\x1B[31m";
-      cout << "[ERROR] ";
+         out << "\x1B[31m";
+      out << "[ERROR] ";
       break;
    }
-   return PrintLinePtr(new PrintLine(cout));
+   return line;
 }
 
-PrintLine::PrintLine(ostream& a_stream)
-   : stream(a_stream)
+PrintLine::PrintLine(ostream& a_target)
+   : target(a_target)
 {
-
+   stream.precision(3);
 }
 
 PrintLine::~PrintLine()
 {
    if (is_stdoutTTY)
-      cout << "\x1B[0m";
+      stream << "\x1B[0m";
 
-   stream << endl;
+   lock_guard<mutex> lock(output_mutex);
+   target << stream.str() << endl;
 }
 
 // Return the single instance of Logger
@@ -21,6 +21,9 @@
 #include "IResource.hpp"
 #include "IConfig.hpp"
 #include "ITrackGraph.hpp"
+#include "Simulation.hpp"
+#include "IXMLParser.hpp"
+#include "Preload.hpp"
 
 #include <stdexcept>
 #include <iostream>
@@ -38,8 +41,10 @@ namespace {
    int new_map_width = 32;
    int new_map_height = 32;
    int run_cycles = 0;
+   int sim_trains = 1;
    string map_file;
    string action;
+   bool validate_xml = false;
 }
 
 static void dump_track_graph(IMapPtr map)
@@ -56,9 +61,13 @@ static void parse_options(int argc, char** argv)
       ("help", "Display this help message")
       ("width", value<int>(&new_map_width), "Set new map width")
       ("height", value<int>(&new_map_height), "Set new map height")
-      ("action", value<string>(&action), "Either `play' or `edit'")
+      ("action", value<string>(&action),
+       "One of `play', `edit', `graph', `simulate', `pack' or `unpack'")
       ("map", value<string>(&map_file), "Name of map to load or create")
       ("cycles", value<int>(&run_cycles), "Run for N frames")
+      ("trains", value<int>(&sim_trains), "Number of trains to simulate")
+      ("validate", bool_switch(&validate_xml),
+       "Check XML files against their schemas")
       ;
 
    positional_options_description p;
@@ -104,16 +113,29 @@ int main(int argc, char** argv)
 
    try {
       if (::action == "" || (::map_file == "" && ::action != "uidemo"))
-         throw runtime_error("Usage: TrainGame (edit|play) [map]");
+         throw runtime_error("Usage: TrainGame "
+                             "(edit|play|graph|simulate|pack|unpack) [map]");
 
       init_resources();
 
+      // The config file is read before we know if it asks for
+      // validation so only the command line affects it
+      set_xml_validation(::validate_xml);
+
       IConfigPtr cfg = get_config();
 
-      bool no_window = action == "graph";
+      if (cfg->get<bool>("ValidateXML"))
+         set_xml_validation(true);
+
+      bool no_window = action == "graph" || action == "simulate"
+         || action == "pack" || action == "unpack";
+
+      if (!no_window) {
+         // Models and textures are decoded while the window is set up
+         start_preloading();
 
-      if (!no_window)
          ::window = make_sdl_window();
+      }
 
       IScreenPtr screen;
       if (::action == "edit") {
@@ -133,9 +155,26 @@ int main(int argc, char** argv)
       else if (::action == "graph") {
          dump_track_graph(load_map(::map_file));
       }
+      else if (::action == "pack") {
+         // Convert the XML map to the binary format
+         load_map(::map_file)->save_binary();
+      }
+      else if (::action == "unpack") {
+         // Regenerate the XML from the binary map
+         load_binary_map(::map_file)->save();
+      }
+      else if (::action == "simulate") {
+         const int default_ticks = 1000;
+         run_simulation(::map_file, ::sim_trains,
+                        ::run_cycles > 0 ? ::run_cycles : default_ticks,
+                        cout);
+      }
       else
          throw runtime_error("Unrecognised command: " + ::action);
 
+      if (!no_window)
+         finish_preloading();
+
       if (::window)
          ::window->run(screen, run_cycles);
 
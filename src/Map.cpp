@@ -30,6 +30,9 @@
 #include "IConfig.hpp"
 #include "OpenGLHelper.hpp"
 #include "ClipVolume.hpp"
+#include "Pool.hpp"
+#include "Preload.hpp"
+#include "HeightCodec.hpp"
 
 #include <stdexcept>
 #include <sstream>
@@ -37,6 +40,9 @@
 #include <fstream>
 #include <set>
 #include <map>
+#include <cstring>
+#include <limits>
+#include <atomic>
 
 #include <boost/filesystem.hpp>
 #include <boost/cstdint.hpp>
@@ -67,9 +73,68 @@ private:
    PointI origin_;
 };
 
-typedef shared_ptr<Anchor<ITrackSegment> > TrackAnchor;
+// Track anchors also remember things about the whole segment which
+// would otherwise have to be looked up on every step along the track
+class TrackNode : public Anchor<ITrackSegment> {
+public:
+   TrackNode(ITrackSegmentPtr track, PointI origin)
+      : Anchor<ITrackSegment>(track, origin)
+   {}
+
+   // Station on one of the endpoints, if any
+   IStationPtr station;
+
+   // Which train is on this segment
+   TrackBlock block;
+};
+
+typedef shared_ptr<TrackNode> TrackAnchor;
 typedef shared_ptr<Anchor<IScenery> > SceneryAnchor;
 
+// Copy of everything which is saved taken on the main thread so it
+// can be written out on another thread while the map is edited
+// Track and scenery aren't changed once they are placed, only
+// replaced, so they are shared with the map rather than copied. This
+// means the snapshot must be released on the main thread since track
+// segments come from pools which aren't thread safe
+class MapSnapshot {
+public:
+   MapSnapshot() : tiles_written(0) {}
+
+   // Write the XML and height map, and the binary copy if refresh_binary
+   void save();
+   void save_binary();
+
+   float progress() const;
+
+   struct Tile {
+      int x, y;
+      ITrackSegmentPtr track;    // Track which starts on this tile
+      bool has_station;
+      int station_id;
+      ISceneryPtr scenery;       // Scenery first seen on this tile
+   };
+
+   IResourcePtr resource;
+   int width, depth;
+   PointI start_location;
+   track::Direction start_direction;
+   vector<float> heights;
+   vector<pair<int, string> > stations;
+   vector<Tile> tiles;
+   bool refresh_binary;
+   bool compress_heights;
+
+private:
+   void write_height_map() const;
+   void write_xml(ostream& of);
+   void write_binary(ostream& of);
+
+   atomic<unsigned> tiles_written;
+};
+
+typedef shared_ptr<MapSnapshot> MapSnapshotPtr;
+
 class Map : public IMap,
             public ISectorRenderable,
             public enable_shared_from_this<Map> {
@@ -93,6 +158,8 @@ public:
    track::Connection start() const;
    ITrackSegmentPtr track_at(const PointI& a_point) const;
    IStationPtr station_at(PointI a_point) const;
+   IStationPtr station_on_track(const PointI& a_point) const;
+   TrackBlockPtr track_block(const PointI& a_point) const;
    void set_track_at(const PointI& a_point, ITrackSegmentPtr a_track);
    bool is_valid_track(const PointI& a_point) const;
    void render(IGraphicsPtr a_context) const;
@@ -110,6 +177,8 @@ public:
    void smooth_area(PointI start, PointI finish);
 
    void save();
+   void save_binary();
+   IMapSavePtr save_in_background();
 
    IStationPtr extend_station(PointI a_start_pos,
                               PointI a_finish_pos);
@@ -121,6 +190,7 @@ public:
    VectorF slope_after(PointI where,
                        track::Direction axis, bool &valid) const;
    void add_scenery(PointI where, ISceneryPtr s);
+   void add_track_listener(weak_ptr<ITrackListener> l);
 
    // ISectorRenderable interface
    void render_sector(IGraphicsPtr a_context, int id,
@@ -193,9 +263,9 @@ private:
       return make_point(a % my_width, a / my_width);
    }
 
-   void write_height_map() const;
-   void save_to(ostream& of);
+   MapSnapshotPtr take_snapshot();
    void read_height_map(IResource::Handle a_handle);
+   void set_height_map(const char* data);
    void tile_vertices(int x, int y, int* indexes) const;
    void render_pick_sector(PointI bot_left, PointI top_right);
    void draw_start_location() const;
@@ -203,6 +273,8 @@ private:
    void render_highlighted_tiles() const;
    void lock_height_at(PointI p);
    void unlock_height_at(PointI p);
+   void notify_track_changed(const PointList& tiles);
+   void update_track_station(PointI p);
 
    // Mesh modification
    void build_mesh(int id, PointI bot_left, PointI top_right);
@@ -227,6 +299,8 @@ private:
    IResourcePtr  resource;
    vector<bool>  sea_sectors;
 
+   list<weak_ptr<ITrackListener> > track_listeners;
+
    // Variables used during rendering
    mutable int frame_num;
    mutable vector<tuple<PointI, Colour> > highlighted_tiles;
@@ -270,15 +344,48 @@ IStationPtr Map::station_at(PointI point) const
    return tile_at(point.x, point.y).station;
 }
 
+IStationPtr Map::station_on_track(const PointI& point) const
+{
+   const TrackAnchor& node = tile_at(point.x, point.y).track;
+   return node ? node->station : IStationPtr();
+}
+
+TrackBlockPtr Map::track_block(const PointI& point) const
+{
+   const TrackAnchor& node = tile_at(point.x, point.y).track;
+   return node ? TrackBlockPtr(node, &node->block) : TrackBlockPtr();
+}
+
+// Find the station on the segment covering this tile again
+void Map::update_track_station(PointI p)
+{
+   const TrackAnchor& node = tile_at(p.x, p.y).track;
+   if (!node)
+      return;
+
+   PointList endpoints;
+   node->get()->get_endpoints(endpoints);
+
+   node->station.reset();
+   for (PointList::const_iterator it = endpoints.begin();
+        it != endpoints.end() && !node->station; ++it)
+      node->station = tile_at((*it).x, (*it).y).station;
+}
+
 void Map::set_station_at(PointI point, IStationPtr station)
 {
    tile_at(point).station = station;
+   update_track_station(point);
+
+   notify_track_changed(PointList(1, point));
 }
 
 void Map::erase_tile(int x, int y)
 {
    Tile& tile = tile_at(x, y);
 
+   PointList changed;
+
    if (tile.track) {
       // We have to be a bit careful since a piece of track has multiple
       // endpoints
@@ -299,6 +406,8 @@ void Map::erase_tile(int x, int y)
          tile_at((*it).x, (*it).y).track.reset();
          dirty_tile((*it).x, (*it).y);
       }
+
+      changed.insert(changed.end(), covers.begin(), covers.end());
    }
 
    if (tile.scenery) {
@@ -318,7 +427,12 @@ void Map::erase_tile(int x, int y)
    if (tile.station) {
       tile.station.reset();
       dirty_tile(x, y);
+
+      changed.push_back(make_point(x, y));
    }
+
+   if (!changed.empty())
+      notify_track_changed(changed);
 }
 
 bool Map::empty_tile(PointI point) const
@@ -339,7 +453,7 @@ void Map::set_track_at(const PointI& where, ITrackSegmentPtr track)
 
    track->set_origin(where.x, where.y, lowest_height);
 
-   TrackAnchor node(new Anchor<ITrackSegment>(track, where));
+   TrackAnchor node = make_pooled<TrackNode>(track, where);
 
    // Attach the track node to every tile it covers
    PointList covers;
@@ -360,6 +474,29 @@ void Map::set_track_at(const PointI& where, ITrackSegmentPtr track)
    for (PointList::iterator it = locked.begin();
         it != locked.end(); ++it)
       lock_height_at(*it);
+
+   update_track_station(where);
+
+   notify_track_changed(covers);
+}
+
+void Map::add_track_listener(weak_ptr<ITrackListener> l)
+{
+   track_listeners.push_back(l);
+}
+
+// Tell everyone interested that the track on these tiles has changed
+void Map::notify_track_changed(const PointList& tiles)
+{
+   list<weak_ptr<ITrackListener> >::iterator it = track_listeners.begin();
+   while (it != track_listeners.end()) {
+      if (ITrackListenerPtr l = (*it).lock()) {
+         l->track_changed(tiles);
+         ++it;
+      }
+      else
+         it = track_listeners.erase(it);
+   }
 }
 
 bool Map::is_valid_track(const PointI& where) const
@@ -406,17 +543,29 @@ void Map::set_start(int x, int y)
       return;
    }
 
+   PointList changed;
+   changed.push_back(start_location);
+   changed.push_back(make_point(x, y));
+
    start_location = make_point(x, y);
    start_direction = poss_dirs[next_dir];
 
    next_dir = (next_dir + 1) % 4;
+
+   notify_track_changed(changed);
 }
 
 // Force the train to start on this tile
 void Map::set_start(int x, int y, int dirX, int dirY)
 {
+   PointList changed;
+   changed.push_back(start_location);
+   changed.push_back(make_point(x, y));
+
    start_location = make_point(x, y);
    start_direction = make_vector(dirX, 0, dirY);
+
+   notify_track_changed(changed);
 }
 
 void Map::set_grid(bool on_off)
@@ -1368,7 +1517,7 @@ void Map::add_scenery(PointI where, ISceneryPtr s)
    if (tile_at(where.x, where.y).track)
       warn() << "Cannot place scenery on track";
    else {
-      SceneryAnchor indirect(new Anchor<IScenery>(s, where));
+      SceneryAnchor indirect = make_pooled<Anchor<IScenery> >(s, where);
 
       const PointI size = s->size();
 
@@ -1457,18 +1606,95 @@ IStationPtr Map::extend_station(PointI a_start_pos, PointI a_finish_pos)
         it != track_in_area.end(); ++it)
       tile_at((*it).x, (*it).y).station = station;
 
+   for (PointList::iterator it = track_in_area.begin();
+        it != track_in_area.end(); ++it)
+      update_track_station(*it);
+
+   notify_track_changed(::PointList(track_in_area.begin(),
+                                    track_in_area.end()));
+
    return station;
 }
 
+// Heights are stored in the .bin and .map files as a uint8 encoding
+// followed by either
+//   HEIGHTS_RAW        Float for each of the vertices
+//   HEIGHTS_QUANTISED  uint32 length then the output of height_codec
+namespace height_block {
+   enum Encoding { HEIGHTS_RAW = 0, HEIGHTS_QUANTISED = 1 };
+
+   // Falls back on raw floats if the heights are out of range
+   void write(ostream& os, const vector<float>& heights,
+              int columns, int rows, bool compress)
+   {
+      vector<uint8_t> encoded;
+      if (compress
+          && height_codec::encode(&heights[0], columns, rows, encoded)) {
+         const uint8_t enc = HEIGHTS_QUANTISED;
+         const uint32_t len = encoded.size();
+         os.write(reinterpret_cast<const char*>(&enc), sizeof(uint8_t));
+         os.write(reinterpret_cast<const char*>(&len), sizeof(uint32_t));
+         os.write(reinterpret_cast<const char*>(&encoded[0]), len);
+      }
+      else {
+         const uint8_t enc = HEIGHTS_RAW;
+         os.write(reinterpret_cast<const char*>(&enc), sizeof(uint8_t));
+         os.write(reinterpret_cast<const char*>(&heights[0]),
+                  heights.size() * sizeof(float));
+      }
+   }
+
+   // Returns the number of bytes used
+   size_t read(const char* data, size_t length, int columns, int rows,
+               vector<float>& heights)
+   {
+      const size_t n = size_t(columns) * rows;
+      heights.resize(n);
+
+      if (length < sizeof(uint8_t))
+         throw runtime_error("Height map is truncated");
+
+      switch (static_cast<uint8_t>(data[0])) {
+      case HEIGHTS_RAW:
+         if (length < 1 + n * sizeof(float))
+            throw runtime_error("Height map is truncated");
+
+         memcpy(&heights[0], data + 1, n * sizeof(float));
+         return 1 + n * sizeof(float);
+
+      case HEIGHTS_QUANTISED:
+         {
+            uint32_t len;
+            if (length < 1 + sizeof(uint32_t))
+               throw runtime_error("Height map is truncated");
+
+            memcpy(&len, data + 1, sizeof(uint32_t));
+            if (length - 1 - sizeof(uint32_t) < len)
+               throw runtime_error("Height map is truncated");
+
+            height_codec::decode(
+               reinterpret_cast<const uint8_t*>(data + 1 + sizeof(uint32_t)),
+               len, columns, rows, &heights[0]);
+            return 1 + sizeof(uint32_t) + len;
+         }
+
+      default:
+         throw runtime_error("Unknown height map encoding");
+      }
+   }
+}
+
 // Write the terrain height map into a binary file
 // Binary file format is very simple:
-//   Bytes 0-3   Width of map
-//   Bytes 4-7   Depth of map
-//   Bytes 8+    Raw height data
-void Map::write_height_map() const
-{
-   using namespace boost;
+//   Bytes 0-3   "TGHM"
+//   Bytes 4-7   Width of map
+//   Bytes 8-11  Depth of map
+//   Bytes 12+   Heights as described for height_block
+// Older files have no "TGHM" and just raw floats after the depth
+static const char HEIGHT_MAP_MAGIC[4] = { 'T', 'G', 'H', 'M' };
 
+void MapSnapshot::write_height_map() const
+{
    IResource::Handle h = resource->write_file(resource->name() + ".bin");
 
    log() << "Writing terrain height map to " << h.file_name();
@@ -1476,18 +1702,18 @@ void Map::write_height_map() const
    try {
       ofstream& of = h.wstream();
 
-      const int32_t wl = static_cast<int32_t>(my_width);
-      const int32_t dl = static_cast<int32_t>(my_depth);
+      const int32_t wl = static_cast<int32_t>(width);
+      const int32_t dl = static_cast<int32_t>(depth);
+      of.write(HEIGHT_MAP_MAGIC, sizeof(HEIGHT_MAP_MAGIC));
       of.write(reinterpret_cast<const char*>(&wl), sizeof(int32_t));
       of.write(reinterpret_cast<const char*>(&dl), sizeof(int32_t));
 
-      for (int i = 0; i < (my_width + 1) * (my_depth + 1); i++)
-         of.write(reinterpret_cast<const char*>(&height_map[i].pos.y),
-            sizeof(float));
+      height_block::write(of, heights, width + 1, depth + 1,
+                          compress_heights);
    }
    catch (std::exception& e) {
       h.rollback();
-      throw e;
+      throw;
    }
 }
 
@@ -1500,9 +1726,18 @@ void Map::read_height_map(IResource::Handle a_handle)
 
    istream& is = a_handle.rstream();
 
+   char magic[4];
+   is.read(magic, sizeof(magic));
+
+   const bool has_magic =
+      memcmp(magic, HEIGHT_MAP_MAGIC, sizeof(HEIGHT_MAP_MAGIC)) == 0;
+
    // Check the dimensions of the binary file match the XML file
    int32_t wl, dl;
-   is.read(reinterpret_cast<char*>(&wl), sizeof(int32_t));
+   if (has_magic)
+      is.read(reinterpret_cast<char*>(&wl), sizeof(int32_t));
+   else
+      memcpy(&wl, magic, sizeof(int32_t));
    is.read(reinterpret_cast<char*>(&dl), sizeof(int32_t));
 
    if (wl != my_width || dl != my_depth) {
@@ -1512,9 +1747,33 @@ void Map::read_height_map(IResource::Handle a_handle)
          ("Binary file " + a_handle.file_name() + " dimensions are incorrect");
    }
 
+   if (has_magic) {
+      const vector<char> data((istreambuf_iterator<char>(is)),
+                              istreambuf_iterator<char>());
+
+      vector<float> heights;
+      height_block::read(data.empty() ? NULL : &data[0], data.size(),
+                         my_width + 1, my_depth + 1, heights);
+
+      set_height_map(reinterpret_cast<const char*>(&heights[0]));
+      return;
+   }
+
+   vector<char> data((my_width + 1) * (my_depth + 1) * sizeof(float));
+   is.read(&data[0], data.size());
+
+   if (!is.good())
+      throw runtime_error
+         ("Binary file " + a_handle.file_name() + " is truncated");
+
+   set_height_map(&data[0]);
+}
+
+// Copy in the height of each vertex from raw floats
+void Map::set_height_map(const char* data)
+{
    for (int i = 0; i < (my_width + 1) * (my_depth + 1); i++) {
-      is.read(reinterpret_cast<char*>(&height_map[i].pos.y),
-              sizeof(float));
+      memcpy(&height_map[i].pos.y, data + i * sizeof(float), sizeof(float));
       height_map[i].lock_count = 0;
    }
 
@@ -1524,48 +1783,167 @@ void Map::read_height_map(IResource::Handle a_handle)
    }
 }
 
-void Map::save_to(ostream& of)
-{
-   xml::element root("map");
-   root.add_attribute("width", my_width);
-   root.add_attribute("height", my_depth);
+// Compact binary copy of a map which loads much faster than the XML
+// The track and scenery are stored as the same elements and attributes
+// as in the XML so they are rebuilt by the same code
+//
+//   Header    char[4] "TGMB", uint32 version, int32 width, depth
+//   Strings   uint32 count then uint16 length and bytes of each
+//   Start     int32 x, y, dirX, dirY
+//   Stations  uint32 count then int32 id and uint16 name of each
+//   Heights   (width + 1) * (depth + 1) vertices as for height_block
+//             or just floats in version 1
+//   Tiles     For each tile: uint8 flags, uint16 x, y then
+//               element if flags & HAS_TRACK
+//               int32 station id if flags & HAS_STATION
+//               element if flags & HAS_SCENERY
+//             The list ends with a zero flags byte
+//   Element   uint16 name, uint8 count then uint16 name and value of
+//             each attribute
+//
+// Strings are referred to by their index in the string table. Values
+// are in the native byte order like the height map
+namespace binary_map {
+   const char MAGIC[4] = { 'T', 'G', 'M', 'B' };
+   const uint32_t FORMAT_VERSION = 2;
+
+   enum { HAS_TRACK = 1, HAS_STATION = 2, HAS_SCENERY = 4 };
+
+   // Strings are collected while the body is generated and written
+   // out in front of it
+   class Writer {
+   public:
+      template <class T>
+      void put(T t)
+      {
+         body.write(reinterpret_cast<const char*>(&t), sizeof(T));
+      }
 
-   root.add_child(xml::element("name").add_text("No Name"));
+      void put_string(const string& str)
+      {
+         map<string, uint16_t>::iterator it = index.find(str);
+         if (it == index.end()) {
+            if (strings.size() > numeric_limits<uint16_t>::max())
+               throw runtime_error("Too many strings for binary map");
 
-   root.add_child
-      (xml::element("start")
-         .add_attribute("x", start_location.x)
-         .add_attribute("y", start_location.y)
-         .add_attribute("dirX", start_direction.x)
-         .add_attribute("dirY", start_direction.z));
+            it = index.insert(
+               make_pair(str, static_cast<uint16_t>(strings.size()))).first;
+            strings.push_back(&(*it).first);
+         }
 
-   // Write out all the stations
-   set<IStationPtr> seen_stations;
+         put((*it).second);
+      }
 
-   for (int x = 0; x < my_width; x++) {
-      for (int y = 0; y < my_depth; y++) {
-         IStationPtr s = tile_at(x, y).station;
+      // Only the name and attributes are stored
+      void put_element(const xml::element& e)
+      {
+         if (e.has_children)
+            throw runtime_error("Binary map cannot store children of "
+                                + e.name);
+
+         if (e.attributes.size() > numeric_limits<uint8_t>::max())
+            throw runtime_error("Too many attributes on " + e.name
+                                + " for binary map");
 
-         if (s && seen_stations.find(s) == seen_stations.end()) {
-            // Not seen this station before
-            root.add_child
-               (xml::element("station")
-                  .add_attribute("id", s->id())
-                  .add_child(xml::element("name").add_text(s->name())));
+         put_string(e.name);
+         put(static_cast<uint8_t>(e.attributes.size()));
 
-            seen_stations.insert(s);
+         for (vector<pair<string, string> >::const_iterator it =
+                 e.attributes.begin(); it != e.attributes.end(); ++it) {
+            put_string((*it).first);
+            put_string((*it).second);
          }
       }
+
+      void write_strings(ostream& os) const
+      {
+         const uint32_t count = strings.size();
+         os.write(reinterpret_cast<const char*>(&count), sizeof(uint32_t));
+
+         for (vector<const string*>::const_iterator it = strings.begin();
+              it != strings.end(); ++it) {
+            if ((*it)->size() > numeric_limits<uint16_t>::max())
+               throw runtime_error("String too long for binary map");
+
+            const uint16_t len = (*it)->size();
+            os.write(reinterpret_cast<const char*>(&len), sizeof(uint16_t));
+            os.write((*it)->data(), len);
+         }
+      }
+
+      ostringstream body;
+
+   private:
+      map<string, uint16_t> index;
+      vector<const string*> strings;
+   };
+
+   // Reads straight out of the buffer holding the whole file
+   class Reader {
+   public:
+      Reader(const vector<char>& buf)
+         : ptr(buf.empty() ? NULL : &buf[0]), end(ptr + buf.size()) {}
+
+      const char* here() const { return ptr; }
+      size_t left() const { return end - ptr; }
+
+      const char* take(size_t bytes)
+      {
+         if (static_cast<size_t>(end - ptr) < bytes)
+            throw runtime_error("Binary map is truncated");
+
+         const char* p = ptr;
+         ptr += bytes;
+         return p;
+      }
+
+      template <class T>
+      T get()
+      {
+         T t;
+         memcpy(&t, take(sizeof(T)), sizeof(T));
+         return t;
+      }
+
+   private:
+      const char* ptr;
+      const char* const end;
+   };
+
+   string file_name(IResourcePtr res)
+   {
+      using namespace boost::filesystem;
+
+      const path xml_file(res->xml_file_name());
+      return (xml_file.parent_path() / (res->name() + ".map")).string();
    }
+}
 
-   // Generate the height map
-   write_height_map();
+// Copy out everything which is saved
+// Scenery covering several tiles is only recorded on the first
+MapSnapshotPtr Map::take_snapshot()
+{
+   using namespace boost::filesystem;
 
-   root.add_child
-      (xml::element("heightmap")
-         .add_text(resource->name() + ".bin"));
+   MapSnapshotPtr snap(new MapSnapshot);
 
-   xml::element tileset("tileset");
+   snap->resource = resource;
+   snap->width = my_width;
+   snap->depth = my_depth;
+   snap->start_location = start_location;
+   snap->start_direction = start_direction;
+
+   // Otherwise the binary copy would be out of date and ignored
+   snap->refresh_binary = exists(binary_map::file_name(resource));
+
+   snap->compress_heights = get_config()->get<bool>("CompressHeightMap");
+
+   const int n_heights = (my_width + 1) * (my_depth + 1);
+   snap->heights.resize(n_heights);
+   for (int i = 0; i < n_heights; i++)
+      snap->heights[i] = height_map[i].pos.y;
+
+   set<IStationPtr> seen_stations;
 
    // We abuse the frame number to ensure all scenery, etc. is
    // only written out once
@@ -1573,64 +1951,257 @@ void Map::save_to(ostream& of)
 
    for (int x = 0; x < my_width; x++) {
       for (int y = 0; y < my_depth; y++) {
-         const Tile& tile = tile_at(x, y);
+         Tile& tile = tile_at(x, y);
 
-         bool useful = false;
-         xml::element tile_xml("tile");
+         const bool has_track = tile.track
+            && tile.track->origin() == make_point(x, y);
+         const bool has_scenery = tile.scenery
+            && tile.scenery->needs_rendering(frame_num);
 
-         tile_xml.add_attribute("x", x);
-         tile_xml.add_attribute("y", y);
+         if (tile.station && seen_stations.insert(tile.station).second)
+            snap->stations.push_back(
+               make_pair(tile.station->id(), tile.station->name()));
 
-         if (tile.track
-             && tile.track->origin() == make_point(x, y)) {
+         if (!(has_track || tile.station || has_scenery))
+            continue;
 
-            tile_xml.add_child(tile.track->get()->to_xml());
-            useful = true;
-         }
+         MapSnapshot::Tile t;
+         t.x = x;
+         t.y = y;
+         t.has_station = static_cast<bool>(tile.station);
+         t.station_id = tile.station ? tile.station->id() : 0;
 
-         if (tile.station) {
-            tile_xml.add_child
-               (xml::element("station-part")
-                  .add_attribute("id", tile.station->id()));
-            useful = true;
-         }
+         if (has_track)
+            t.track = tile.track->get();
 
-         if (tile.scenery && tile.scenery->needs_rendering(frame_num)) {
-            tile_xml.add_child(tile.scenery->get()->to_xml());
+         if (has_scenery) {
+            t.scenery = tile.scenery->get();
             tile.scenery->rendered_on(frame_num);
-            useful = true;
          }
 
-         if (useful)
-            tileset.add_child(tile_xml);
+         snap->tiles.push_back(t);
       }
    }
 
-   root.add_child(tileset);
+   return snap;
+}
+
+float MapSnapshot::progress() const
+{
+   const unsigned total = tiles.size() * (refresh_binary ? 2 : 1);
+   return total == 0 ? 1.0f : min(1.0f, float(tiles_written) / total);
+}
+
+void MapSnapshot::write_xml(ostream& of)
+{
+   // Elements are written as soon as they are generated so the whole
+   // document never has to be held in memory
+   xml::writer w(of);
+
+   w.begin("map")
+      .add_attribute("width", width)
+      .add_attribute("height", depth);
+
+   w.begin("name").add_text("No Name").end();
+
+   w.begin("start")
+      .add_attribute("x", start_location.x)
+      .add_attribute("y", start_location.y)
+      .add_attribute("dirX", start_direction.x)
+      .add_attribute("dirY", start_direction.z)
+      .end();
+
+   // Write out all the stations
+   for (vector<pair<int, string> >::const_iterator it = stations.begin();
+        it != stations.end(); ++it) {
+      w.begin("station").add_attribute("id", (*it).first);
+      w.begin("name").add_text((*it).second).end();
+      w.end();
+   }
+
+   // Generate the height map
+   write_height_map();
+
+   w.begin("heightmap")
+      .add_text(resource->name() + ".bin")
+      .end();
+
+   w.begin("tileset");
+
+   for (vector<Tile>::const_iterator it = tiles.begin();
+        it != tiles.end(); ++it) {
+      w.begin("tile")
+         .add_attribute("x", (*it).x)
+         .add_attribute("y", (*it).y);
+
+      if ((*it).track)
+         w.add_child((*it).track->to_xml());
 
-   of << xml::document(root);
+      if ((*it).has_station)
+         w.begin("station-part")
+            .add_attribute("id", (*it).station_id)
+            .end();
+
+      if ((*it).scenery)
+         w.add_child((*it).scenery->to_xml());
+
+      w.end();
+
+      ++tiles_written;
+   }
+
+   w.end();  // tileset
+   w.end();  // map
 }
 
 // Turn the map into XML
-void Map::save()
+void MapSnapshot::save()
 {
-   using namespace boost::filesystem;
+   {
+      IResource::Handle h = resource->write_file(resource->name() + ".xml");
+
+      log() << "Saving map to " << h.file_name();
+
+      ofstream& of = h.wstream();
+
+      try {
+         write_xml(of);
+      }
+      catch (exception& e) {
+         h.rollback();
+         throw;
+      }
+   }
+
+   if (refresh_binary)
+      save_binary();
+}
+
+void MapSnapshot::write_binary(ostream& of)
+{
+   using namespace binary_map;
+
+   Writer w;
+
+   w.put(static_cast<int32_t>(start_location.x));
+   w.put(static_cast<int32_t>(start_location.y));
+   w.put(static_cast<int32_t>(start_direction.x));
+   w.put(static_cast<int32_t>(start_direction.z));
+
+   w.put(static_cast<uint32_t>(stations.size()));
+   for (vector<pair<int, string> >::const_iterator it = stations.begin();
+        it != stations.end(); ++it) {
+      w.put(static_cast<int32_t>((*it).first));
+      w.put_string((*it).second);
+   }
+
+   height_block::write(w.body, heights, width + 1, depth + 1,
+                       compress_heights);
+
+   for (vector<Tile>::const_iterator it = tiles.begin();
+        it != tiles.end(); ++it) {
+      const uint8_t flags = ((*it).track ? HAS_TRACK : 0)
+         | ((*it).has_station ? HAS_STATION : 0)
+         | ((*it).scenery ? HAS_SCENERY : 0);
+
+      w.put(flags);
+      w.put(static_cast<uint16_t>((*it).x));
+      w.put(static_cast<uint16_t>((*it).y));
+
+      if ((*it).track)
+         w.put_element((*it).track->to_xml());
 
-   IResource::Handle h = resource->write_file(resource->name() + ".xml");
+      if ((*it).has_station)
+         w.put(static_cast<int32_t>((*it).station_id));
 
-   log() << "Saving map to " << h.file_name();
+      if ((*it).scenery)
+         w.put_element((*it).scenery->to_xml());
 
-   ofstream& of = h.wstream();
+      ++tiles_written;
+   }
+
+   w.put(static_cast<uint8_t>(0));
+
+   const int32_t wl = static_cast<int32_t>(width);
+   const int32_t dl = static_cast<int32_t>(depth);
+
+   of.write(MAGIC, sizeof(MAGIC));
+   of.write(reinterpret_cast<const char*>(&FORMAT_VERSION), sizeof(uint32_t));
+   of.write(reinterpret_cast<const char*>(&wl), sizeof(int32_t));
+   of.write(reinterpret_cast<const char*>(&dl), sizeof(int32_t));
+
+   w.write_strings(of);
+   of << w.body.rdbuf();
+}
+
+void MapSnapshot::save_binary()
+{
+   if (width > numeric_limits<uint16_t>::max()
+       || depth > numeric_limits<uint16_t>::max())
+      throw runtime_error("Map is too big for the binary format");
+
+   IResource::Handle h = resource->write_file(resource->name() + ".map");
+
+   log() << "Saving binary map to " << h.file_name();
 
    try {
-      save_to(of);
+      write_binary(h.wstream());
    }
    catch (exception& e) {
       h.rollback();
-      throw e;
+      throw;
    }
 }
 
+// Runs MapSnapshot::save on a loader thread
+// The snapshot is kept here rather than by the task so that it is
+// released on the main thread
+class BackgroundSave : public IMapSave {
+public:
+   BackgroundSave(MapSnapshotPtr a_snapshot)
+      : snapshot(a_snapshot),
+        result(loader_pool().submit(function<void ()>(
+           bind(&MapSnapshot::save, a_snapshot.get()))))
+   {}
+
+   ~BackgroundSave()
+   {
+      // The task still refers to the snapshot
+      result.wait();
+   }
+
+   // IMapSave interface
+   float progress() const { return snapshot->progress(); }
+
+   bool done()
+   {
+      if (!result.ready())
+         return false;
+
+      result.get();
+      return true;
+   }
+
+private:
+   MapSnapshotPtr snapshot;
+   ThreadPool::Job<void> result;
+};
+
+void Map::save()
+{
+   take_snapshot()->save();
+}
+
+void Map::save_binary()
+{
+   take_snapshot()->save_binary();
+}
+
+IMapSavePtr Map::save_in_background()
+{
+   return IMapSavePtr(new BackgroundSave(take_snapshot()));
+}
+
 IMapPtr make_empty_map(const string& a_res_id, int a_width, int a_depth)
 {
    IResourcePtr res = make_new_resource(a_res_id, "maps");
@@ -1651,6 +2222,10 @@ public:
    void start_element(const string& local_name, const AttributeSet& attrs);
    void end_element(const string& local_name);
    void text(const string& local_name, const string& a_string);
+   bool wants_text(const string& local_name) const;
+
+   // Build the map from a binary copy instead
+   bool read_binary(const vector<char>& buf);
 
 private:
    void handle_map(const AttributeSet& attrs);
@@ -1665,6 +2240,10 @@ private:
    void handle_points(const AttributeSet& attrs);
    void handle_crossover_track(const AttributeSet& attrs);
    void handle_spline_track(const AttributeSet& attrs);
+   void add_station_part(int id);
+
+   void read_element(binary_map::Reader& in, const vector<string>& strings,
+                     AttributeSet::Pairs& pairs);
 
    shared_ptr<Map> my_map;
    map<int, IStationPtr> my_stations;
@@ -1710,6 +2289,11 @@ void MapLoader::end_element(const string& local_name)
       my_active_station.reset();
 }
 
+bool MapLoader::wants_text(const string& local_name) const
+{
+   return local_name == "heightmap" || local_name == "name";
+}
+
 void MapLoader::text(const string& local_name, const string& a_string)
 {
    if (local_name == "heightmap")
@@ -1772,6 +2356,11 @@ void MapLoader::handle_station_part(const AttributeSet& attrs)
    int id;
    attrs.get("id", id);
 
+   add_station_part(id);
+}
+
+void MapLoader::add_station_part(int id)
+{
    map<int, IStationPtr>::iterator it = my_stations.find(id);
    if (it == my_stations.end())
       throw runtime_error("No station definition for ID "
@@ -1849,18 +2438,192 @@ void MapLoader::handle_spline_track(const AttributeSet& attrs)
    my_map->set_track_at(tile, make_spline_track(delta, entry_dir, exit_dir));
 }
 
+namespace {
+   const string& binary_string(const vector<string>& strings, uint16_t i)
+   {
+      if (i >= strings.size())
+         throw runtime_error("Bad string in binary map");
+      return strings[i];
+   }
+}
+
+// Replay a track or scenery element as if it came from the XML
+void MapLoader::read_element(binary_map::Reader& in,
+                             const vector<string>& strings,
+                             AttributeSet::Pairs& pairs)
+{
+   const string& name = binary_string(strings, in.get<uint16_t>());
+
+   pairs.clear();
+   for (uint8_t n = in.get<uint8_t>(); n > 0; n--) {
+      const string& attr = binary_string(strings, in.get<uint16_t>());
+      const string& value = binary_string(strings, in.get<uint16_t>());
+      pairs.push_back(make_pair(&attr, &value));
+   }
+
+   start_element(name, AttributeSet(pairs));
+   end_element(name);
+}
+
+// Returns false without changing the map if the file is from a
+// different version of the format
+bool MapLoader::read_binary(const vector<char>& buf)
+{
+   using namespace binary_map;
+
+   Reader in(buf);
+
+   if (memcmp(in.take(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0)
+      throw runtime_error("Not a binary map file");
+
+   // Version 1 only differs in how the heights are stored
+   const uint32_t version = in.get<uint32_t>();
+   if (version != FORMAT_VERSION && version != 1) {
+      warn() << "Binary map has version " << version
+             << " but expected " << FORMAT_VERSION;
+      return false;
+   }
+
+   const int32_t width = in.get<int32_t>();
+   const int32_t depth = in.get<int32_t>();
+   if (width <= 0 || depth <= 0)
+      throw runtime_error("Bad dimensions in binary map");
+
+   my_map->reset_map(width, depth);
+
+   // Every string needs at least its length
+   const uint32_t n_strings = in.get<uint32_t>();
+   if (n_strings > in.left() / sizeof(uint16_t))
+      throw runtime_error("Binary map is truncated");
+
+   vector<string> strings(n_strings);
+   for (vector<string>::iterator it = strings.begin();
+        it != strings.end(); ++it) {
+      const uint16_t len = in.get<uint16_t>();
+      (*it).assign(in.take(len), len);
+   }
+
+   const int32_t x = in.get<int32_t>();
+   const int32_t y = in.get<int32_t>();
+   const int32_t dirX = in.get<int32_t>();
+   const int32_t dirY = in.get<int32_t>();
+   my_map->set_start(x, y, dirX, dirY);
+
+   for (uint32_t n = in.get<uint32_t>(); n > 0; n--) {
+      IStationPtr station = make_station();
+
+      const int32_t id = in.get<int32_t>();
+      station->set_id(id);
+      station->set_name(binary_string(strings, in.get<uint16_t>()));
+
+      my_stations[id] = station;
+   }
+
+   if (version == 1)
+      my_map->set_height_map(
+         in.take((width + 1) * (depth + 1) * sizeof(float)));
+   else {
+      vector<float> heights;
+      in.take(height_block::read(in.here(), in.left(),
+                                 width + 1, depth + 1, heights));
+      my_map->set_height_map(reinterpret_cast<const char*>(&heights[0]));
+   }
+
+   AttributeSet::Pairs pairs;
+   while (const uint8_t flags = in.get<uint8_t>()) {
+      tile.x = in.get<uint16_t>();
+      tile.y = in.get<uint16_t>();
+
+      if (tile.x >= width || tile.y >= depth)
+         throw runtime_error("Bad tile in binary map");
+
+      if (flags & HAS_TRACK)
+         read_element(in, strings, pairs);
+
+      if (flags & HAS_STATION)
+         add_station_part(in.get<int32_t>());
+
+      if (flags & HAS_SCENERY)
+         read_element(in, strings, pairs);
+   }
+
+   return true;
+}
+
+// Read the whole of the binary copy of a map into memory
+static void read_binary_file(const string& file_name, vector<char>& buf)
+{
+   ifstream is(file_name.c_str(), ios::binary);
+   if (!is.good())
+      throw runtime_error("Failed to open binary map " + file_name);
+
+   is.seekg(0, ios::end);
+   buf.resize(is.tellg());
+   is.seekg(0, ios::beg);
+
+   if (!buf.empty())
+      is.read(&buf[0], buf.size());
+
+   if (!is.good())
+      throw runtime_error("Failed to read binary map " + file_name);
+}
+
 IMapPtr load_map(const string& a_res_id)
 {
+   using namespace boost::filesystem;
+
    IResourcePtr res = find_resource(a_res_id, "maps");
 
-   shared_ptr<Map> map(new Map(res));
+   // Use the binary copy unless the XML has been changed since
+   const string bin_file = binary_map::file_name(res);
+   if (exists(bin_file)
+       && last_write_time(bin_file) >= last_write_time(res->xml_file_name())) {
+      log() << "Loading map from file " << bin_file;
+
+      try {
+         vector<char> buf;
+         read_binary_file(bin_file, buf);
+
+         shared_ptr<Map> map(new Map(res));
+         MapLoader loader(map, res);
+
+         if (loader.read_binary(buf))
+            return IMapPtr(map);
+      }
+      catch (const runtime_error& e) {
+         warn() << "Cannot read " << bin_file << ": " << e.what();
+      }
+   }
 
    log() << "Loading map from file " << res->xml_file_name();
 
    static IXMLParserPtr xml_parser = make_xml_parser("schemas/map.xsd");
 
+   // Start again as a broken binary map may have been half loaded
+   shared_ptr<Map> map(new Map(res));
    MapLoader loader(map, res);
+
    xml_parser->parse(res->xml_file_name(), loader);
 
    return IMapPtr(map);
 }
+
+IMapPtr load_binary_map(const string& a_res_id)
+{
+   IResourcePtr res = find_resource(a_res_id, "maps");
+
+   shared_ptr<Map> map(new Map(res));
+   MapLoader loader(map, res);
+
+   const string bin_file = binary_map::file_name(res);
+
+   log() << "Loading map from file " << bin_file;
+
+   vector<char> buf;
+   read_binary_file(bin_file, buf);
+
+   if (!loader.read_binary(buf))
+      throw runtime_error("Cannot read this version of " + bin_file);
+
+   return IMapPtr(map);
+}
@@ -54,6 +54,7 @@ struct MeshBuffer : IMeshBuffer {
 
    size_t vertex_count() const;
    size_t index_count() const;
+   size_t memory_size() const;
 
    void add(const Vertex& vertex,
             const Normal& normal,
@@ -283,6 +284,25 @@ struct VertexData {
 
 BOOST_STATIC_ASSERT(sizeof(VertexData) == 64);
 
+// Counts both the chunks here and the packed copy a mesh keeps in
+// video memory or as a vertex array
+size_t MeshBuffer::memory_size() const
+{
+   size_t sum = sizeof(MeshBuffer);
+
+   for (vector<ChunkPtr>::const_iterator it = chunks.begin();
+        it != chunks.end(); ++it) {
+      sum += (*it)->vertices.capacity() * sizeof(Vertex)
+         + (*it)->normals.capacity() * sizeof(Normal)
+         + (*it)->colours.capacity() * sizeof(Colour)
+         + (*it)->indices.capacity() * sizeof(Index)
+         + (*it)->tex_coords.capacity() * sizeof(TexCoord);
+   }
+
+   return sum + vertex_count() * sizeof(VertexData)
+      + index_count() * sizeof(GLushort);
+}
+
 // Get the vertex data out of a mesh buffer into a VertexData array
 static void copy_vertex_data(const MeshBuffer* buf, VertexData* vertex_data)
 {
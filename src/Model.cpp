@@ -20,13 +20,14 @@
 #include "ITexture.hpp"
 #include "ILogger.hpp"
 #include "IMesh.hpp"
-#include "ResourceCache.hpp"
+#include "LRUCache.hpp"
+#include "IConfig.hpp"
+#include "Preload.hpp"
+#include "WavefrontParser.hpp"
 
 #include <string>
-#include <fstream>
 #include <vector>
 #include <sstream>
-#include <cassert>
 #include <stdexcept>
 #include <algorithm>
 #include <map>
@@ -34,10 +35,18 @@
 
 #include <boost/lexical_cast.hpp>
 
+struct ModelData;
+typedef shared_ptr<ModelData> ModelDataPtr;
+
+static size_t model_data_size(const ModelDataPtr& data);
+
 // Cache of already loaded models
+// The budget is set from the config before anything is added
 namespace {
-   typedef map<string, IModelPtr> ModelCache;
-   ModelCache the_cache;
+   LRUCache<IModel> the_cache(0);
+
+   // Models read on the loader threads
+   PrefetchTable<ModelDataPtr> the_prefetched_models(model_data_size);
 }
 
 struct Material {
@@ -50,7 +59,7 @@ struct Material {
    float diffuseR, diffuseG, diffuseB;
    float ambientR, ambientG, ambientB;
    float specularR, specularG, specularB;
-   ITexturePtr texture;
+   string texture_file;
 };
 
 // Abstracts a WaveFront material file
@@ -60,6 +69,7 @@ public:
    ~MaterialFile() {}
 
    const Material& get(const string& a_name) const;
+   void texture_files(vector<string>& files) const;
 private:
    typedef map<string, Material> MaterialSet;
    MaterialSet my_materials;
@@ -67,53 +77,70 @@ private:
 
 typedef shared_ptr<MaterialFile> MaterialFilePtr;
 
-MaterialFile::MaterialFile(const string& a_file_name, IResourcePtr a_res)
-{
-   IResource::Handle h = a_res->open_file(a_file_name);
+// Fills in a material file as the parser reads it
+struct MaterialReader {
+   MaterialReader(map<string, Material>& a_materials, IResourcePtr a_res)
+      : materials(a_materials), res(a_res), active(NULL)
+   {}
 
-   log() << "Loading materials from " << h.file_name();
+   void new_material(const string& name)
+   {
+      active = &(materials[name] = Material());
+   }
 
-   istream& is = h.rstream();
+   void diffuse(float r, float g, float b)
+   {
+      Material& m = current();
+      m.diffuseR = r; m.diffuseG = g; m.diffuseB = b;
+   }
 
-   string active_material;
-   while (!is.eof()) {
-      string word;
-      is >> word;
+   void ambient(float r, float g, float b)
+   {
+      Material& m = current();
+      m.ambientR = r; m.ambientG = g; m.ambientB = b;
+   }
 
-      if (word[0] == '#') {
-         // Comment
-         continue;
-      }
-      else if (word == "newmtl") {
-         is >> active_material;
+   void specular(float r, float g, float b)
+   {
+      Material& m = current();
+      m.specularR = r; m.specularG = g; m.specularB = b;
+   }
 
-         my_materials[active_material] = Material();
-      }
-      else if (word == "map_Kd") {
-         // Texture
-         is >> word;
-         my_materials[active_material].texture = load_texture(a_res, word);
-      }
-      else if (word == "Kd") {
-         // Diffuse colour
-         Material& m = my_materials[active_material];
-         is >> m.diffuseR >> m.diffuseG >> m.diffuseB;
-      }
-      else if (word == "Ka") {
-         // Ambient colour
-         Material& m = my_materials[active_material];
-         is >> m.ambientR >> m.ambientG >> m.ambientB;
-      }
-      else if (word == "Ks") {
-         // Specular colour
-         Material& m = my_materials[active_material];
-         is >> m.specularR >> m.specularG >> m.specularB;
-      }
-      else {
-         // Ignore it
-         continue;
+   void diffuse_map(const string& file_name)
+   {
+      // Only decode it here as this may not be the main thread
+      string real_file_name;
+      {
+         IResource::Handle h = res->open_file(file_name);
+         real_file_name = h.file_name();
       }
+
+      current().texture_file = real_file_name;
+      prefetch_texture(real_file_name);
+   }
+
+   // Settings before the first newmtl go in a material with no name
+   Material& current()
+   {
+      if (active == NULL)
+         active = &materials[""];
+      return *active;
    }
+
+   map<string, Material>& materials;
+   IResourcePtr res;
+   Material* active;
+};
+
+MaterialFile::MaterialFile(const string& a_file_name, IResourcePtr a_res)
+{
+   IResource::Handle h = a_res->open_file(a_file_name);
+
+   log() << "Loading materials from " << h.file_name();
+
+   wavefront::MappedFile file(h.file_name());
+   MaterialReader reader(my_materials, a_res);
+   wavefront::parse_mtl(file.begin(), file.end(), h.file_name(), reader);
 }
 
 const Material& MaterialFile::get(const string& a_name) const
@@ -125,11 +152,25 @@ const Material& MaterialFile::get(const string& a_name) const
    return (*it).second;
 }
 
+void MaterialFile::texture_files(vector<string>& files) const
+{
+   for (MaterialSet::const_iterator it = my_materials.begin();
+        it != my_materials.end(); ++it) {
+      if (!(*it).second.texture_file.empty())
+         files.push_back((*it).second.texture_file);
+   }
+}
+
+// Everything read from the model files which doesn't need OpenGL
+struct ModelData {
+   Vector<float> dimensions;
+   IMeshBufferPtr buffer;
+   vector<string> texture_files;
+};
+
 class Model : public IModel {
 public:
-   Model(const Vector<float>& dim, const IMeshBufferPtr buf)
-      : dimensions_(dim), buffer(buf)
-   {}
+   Model(const ModelData& data);
    ~Model();
 
    // IModel interface
@@ -144,8 +185,17 @@ private:
    Vector<float> dimensions_;
    mutable IMeshPtr mesh;
    const IMeshBufferPtr buffer;
+   vector<ITexturePtr> textures;
 };
 
+Model::Model(const ModelData& data)
+   : dimensions_(data.dimensions), buffer(data.buffer)
+{
+   for (vector<string>::const_iterator it = data.texture_files.begin();
+        it != data.texture_files.end(); ++it)
+      textures.push_back(load_texture(*it));
+}
+
 Model::~Model()
 {
 
@@ -176,186 +226,214 @@ void Model::compile_mesh() const
    mesh = make_mesh(buffer);
 }
 
-// Load a model from a resource
-IModelPtr load_model(IResourcePtr a_res,
-                     const string& a_file_name,
-                     float a_scale,
-                     Vector<float> shift)
-{
-   // Make a unique cache name
-   const string cache_name = a_res->name() + ":" + a_file_name;
-
-   // Check the cache for the model
-   ModelCache::iterator it = the_cache.find(cache_name);
-   if (it != the_cache.end())
-      return (*it).second;
+// Builds the mesh for a model as the parser reads it
+struct ModelReader {
+   ModelReader(IResourcePtr a_res, float a_scale, Vector<float> a_shift)
+      : res(a_res), scale(a_scale), shift(a_shift),
+        buffer(make_mesh_buffer()), face_count(0),
+        found_vertex(false),
+        xmin(0), xmax(0), ymin(0), ymax(0), zmin(0), zmax(0)
+   {}
 
-   // Not in the cache, load it from the resource
-   IResource::Handle h = a_res->open_file(a_file_name);
-   log() << "Loading model " << h.file_name();
+   void material_lib(const string& file_name)
+   {
+      material_file = MaterialFilePtr(new MaterialFile(file_name, res));
+   }
 
-   vector<IMeshBuffer::Vertex> vertices;
-   vector<IMeshBuffer::Normal> normals;
-   vector<IMeshBuffer::TexCoord> texture_offs;
+   void use_material(const string& name)
+   {
+      if (material_file)
+         active_mtl = material_file->get(name);
+   }
 
-   IMeshBufferPtr buffer = make_mesh_buffer();
+   void vertex(float x, float y, float z)
+   {
+      x = (x + shift.x) * scale;
+      y = (y + shift.y) * scale;
+      z = (z + shift.z) * scale;
 
-   bool found_vertex = false;
-   float ymin = 0, ymax = 0, xmin = 0, xmax = 0,
-      zmin = 0, zmax = 0;
-   int face_count = 0;
+      if (found_vertex) {
+         xmin = min(x, xmin);
+         xmax = max(x, xmax);
 
-   MaterialFilePtr material_file;
-   Material active_mtl;
+         ymin = min(y, ymin);
+         ymax = max(y, ymax);
 
-   ifstream& f = h.rstream();
-
-   while (!f.eof()) {
-      string first;
-      f >> first;
-
-      if (first[0] == '#') {
-         // Comment
+         zmin = min(z, zmin);
+         zmax = max(z, zmax);
       }
-      else if (first == "o") {
-         // New object
-         string obj_name;
-         f >> obj_name;
-      }
-      else if (first == "mtllib") {
-         // Material file
-         string file_name;
-         f >> file_name;
+      else {
+         xmin = xmax = x;
+         ymin = ymax = y;
+         zmin = zmax = z;
 
-         material_file =
-            MaterialFilePtr(new MaterialFile(file_name, a_res));
+         found_vertex = true;
       }
-      else if (first == "v") {
-         // Vertex
-         float x, y, z;
-         f >> x >> y >> z;
 
-         x += shift.x;
-         y += shift.y;
-         z += shift.z;
-
-         x *= a_scale;
-         y *= a_scale;
-         z *= a_scale;
+      vertices.push_back(make_vector(x, y, z));
+   }
 
-         if (found_vertex) {
-            xmin = min(x, xmin);
-            xmax = max(x, xmax);
+   void normal(float x, float y, float z)
+   {
+      normals.push_back(make_vector(x, y, z));
+   }
 
-            ymin = min(y, ymin);
-            ymax = max(y, ymax);
+   void tex_coord(float u, float v)
+   {
+      texture_offs.push_back(make_point(u, v));
+   }
 
-            zmin = min(z, zmin);
-            zmax = max(z, zmax);
+   void face(const wavefront::FaceVertex* corners, unsigned n,
+             unsigned line)
+   {
+      if (n != 3)
+         warn() << "All model faces must be triangles "
+                << "(face with " << n << " vertices on line " << line << ")";
+
+      const Colour col = make_colour(active_mtl.diffuseR,
+                                     active_mtl.diffuseG,
+                                     active_mtl.diffuseB);
+
+      for (unsigned i = 0; i < n; i++) {
+         const wavefront::FaceVertex& fv = corners[i];
+
+         if (fv.v > vertices.size() || fv.vn > normals.size()) {
+            ostringstream ss;
+            ss << "Face on line " << line << " refers to a missing "
+               << "vertex or normal";
+            throw runtime_error(ss.str());
          }
-         else {
-            xmin = xmax = x;
-            ymin = ymax = y;
-            zmin = zmax = z;
 
-            found_vertex = true;
-         }
+         const Vector<float>& v = vertices[fv.v - 1];
+         const Vector<float>& vn = normals[fv.vn - 1];
 
-         vertices.push_back(make_vector(x, y, z));
+         if (fv.vt > 0 && fv.vt <= texture_offs.size())
+            buffer->add(v, vn, col, texture_offs[fv.vt - 1]);
+         else
+            buffer->add(v, vn, col);
       }
-      else if (first == "vn") {
-         // Normal
-         float x, y, z;
-         f >> x >> y >> z;
 
-         normals.push_back(make_vector(x, y, z));
-      }
-      else if (first == "vt") {
-         // Texture coordinate
-         float x, y;
-         f >> x >> y;
+      face_count++;
+   }
 
-         texture_offs.push_back(make_point(x, y));
-      }
-      else if (first == "g") {
-         // Groups used to correspond to sub-meshes but now
-         // the whole model is compiled into a single mesh
-      }
-      else if (first == "usemtl") {
-         // Set the material for this group
-         string material_name;
-         f >> material_name;
-
-         if (material_file) {
-            assert(buffer);
-            active_mtl = material_file->get(material_name);
-         }
-      }
-      else if (first == "f") {
-         // Face
-         string line;
-         getline(f, line);
-         istringstream ss(line);
-
-         int v_in_thisFace = 0;
-
-         while (!ss.eof()) {
-            char delim1, delim2;
-            unsigned vi, vti, vni;
-            ss >> vi >> delim1;
-            if (ss.fail())
-               break;
-
-            if (++v_in_thisFace > 3)
-               warn () << "All model faces must be triangles "
-                       << "(face with " << v_in_thisFace << " vertices)";
-
-            // Texture coordinate may be omitted
-            ss >> vti;
-            if (ss.fail()) {
-               vti = -1;
-               ss.clear();
-            }
-
-            ss >> delim2 >> vni;
-            assert(delim1 == '/' && delim2 == '/');
-
-            Vector<float>& v = vertices[vi - 1];
-            Vector<float>& vn = normals[vni - 1];
-
-            assert(buffer);
-
-            const Colour col = make_colour(active_mtl.diffuseR,
-                                           active_mtl.diffuseG,
-                                           active_mtl.diffuseB);
-
-            if (vti - 1 < texture_offs.size()) {
-               Point<float>& vt = texture_offs[vti - 1];
-               buffer->add(v, vn, col, vt);
-            }
-            else
-               buffer->add(v, vn, col);
-         }
+   IResourcePtr res;
+   const float scale;
+   const Vector<float> shift;
+
+   vector<IMeshBuffer::Vertex> vertices;
+   vector<IMeshBuffer::Normal> normals;
+   vector<IMeshBuffer::TexCoord> texture_offs;
 
-         face_count++;
+   IMeshBufferPtr buffer;
+   int face_count;
 
-         // Don't discard the next line
-         continue;
-      }
+   MaterialFilePtr material_file;
+   Material active_mtl;
 
-      // Discard the rest of the line
-      getline(f, first);
+   bool found_vertex;
+   float xmin, xmax, ymin, ymax, zmin, zmax;
+};
+
+// Parse a model without using OpenGL so it can be done on any thread
+static ModelDataPtr read_model(IResourcePtr a_res,
+                               const string& a_file_name,
+                               float a_scale,
+                               Vector<float> shift)
+{
+   IResource::Handle h = a_res->open_file(a_file_name);
+   log() << "Loading model " << h.file_name();
+
+   ModelReader reader(a_res, a_scale, shift);
+   {
+      wavefront::MappedFile file(h.file_name());
+      wavefront::parse_obj(file.begin(), file.end(), h.file_name(), reader);
    }
 
-   Vector<float> dim = make_vector(xmax - xmin, ymax - ymin, zmax - zmin);
+   log() << "Model loaded: " << reader.vertices.size() << " vertices, "
+         << reader.face_count << " faces";
 
-   log() << "Model loaded: " << vertices.size() << " vertices, "
-         << face_count << " faces";
+   ModelDataPtr data(new ModelData);
+   data->dimensions = make_vector(reader.xmax - reader.xmin,
+                                  reader.ymax - reader.ymin,
+                                  reader.zmax - reader.zmin);
+   data->buffer = reader.buffer;
 
-   IModelPtr ptr(new Model(dim, buffer));
+   if (reader.material_file)
+      reader.material_file->texture_files(data->texture_files);
+
+   return data;
+}
+
+static string model_cache_name(IResourcePtr a_res, const string& a_file_name)
+{
+   return a_res->name() + ":" + a_file_name;
+}
+
+static size_t model_data_size(const ModelDataPtr& data)
+{
+   return data->buffer->memory_size();
+}
+
+static size_t model_budget()
+{
+   return size_t(get_config()->get<int>("ModelCacheMB")) * 1024 * 1024;
+}
+
+void set_model_prefetch_budget()
+{
+   the_prefetched_models.set_budget(model_budget());
+}
+
+void prefetch_model(IResourcePtr a_res,
+                    const string& a_file_name,
+                    float a_scale,
+                    Vector<float> shift)
+{
+   the_prefetched_models.start(model_cache_name(a_res, a_file_name),
+      bind(read_model, a_res, a_file_name, a_scale, shift));
+}
+
+// Load a model from a resource
+IModelPtr load_model(IResourcePtr a_res,
+                     const string& a_file_name,
+                     float a_scale,
+                     Vector<float> shift)
+{
+   // Make a unique cache name
+   const string cache_name = model_cache_name(a_res, a_file_name);
+
+   // Check the cache for the model
+   IModelPtr cached = the_cache.find(cache_name);
+   if (cached)
+      return cached;
+
+   // Not in the cache, load it from the resource unless it was
+   // already read in the background
+   ModelDataPtr data;
+   if (!the_prefetched_models.take(cache_name, data))
+      data = read_model(a_res, a_file_name, a_scale, shift);
+
+   IModelPtr ptr(new Model(*data));
+
+   // Models used by anything on the map stay in memory whatever the
+   // budget says. Models read in the background but not used yet
+   // take their share of the budget
+   const size_t budget = model_budget();
+   const size_t prefetched =
+      min(budget, the_prefetched_models.outstanding());
+   the_cache.set_budget(budget - prefetched);
+   the_cache.insert(cache_name, ptr, model_data_size(data));
+
+   debug() << "Model cache using " << the_cache.used() / 1024 << "KB for "
+           << the_cache.size() << " models with " << prefetched / 1024
+           << "KB prefetched";
 
-   the_cache[cache_name] = ptr;
    return ptr;
 }
 
+void discard_prefetched_models()
+{
+   the_prefetched_models.clear();
+}
+
 
@@ -21,8 +21,18 @@
 #include "Random.hpp"
 #include "Paths.hpp"
 
+#include "Preload.hpp"
+
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 class NoiseTexture : public ITexture {
 public:
@@ -36,9 +46,9 @@ public:
 
 private:
    void build_noise(GLubyte *pixels);
+   void build_rows(GLubyte *pixels, atomic<int>* next_row) const;
    void save_noise(const GLubyte *pixels);
-   void load_noise(GLubyte *pixels);
-   float noise2d(float x, float y) const;
+   bool load_noise(GLubyte *pixels);
 
    boost::filesystem::path cache_name();
    
@@ -46,6 +56,227 @@ private:
    GLuint texture;
 };
 
+// The cache file starts with a header so a file made with different
+// settings or cut short is noticed and the noise built again
+//
+//   Header    char[4] "TGNZ", uint32 version, int32 size, resolution,
+//             base, range, octaves, uint32 checksum of the pixels
+//   Pixels    One byte for each pixel a row at a time
+namespace {
+
+   const char NOISE_MAGIC[4] = { 'T', 'G', 'N', 'Z' };
+   const uint32_t NOISE_VERSION = 1;
+
+   const int OCTAVES = 8;
+
+   struct NoiseHeader {
+      char magic[4];
+      uint32_t version;
+      int32_t size, resolution, base, range, octaves;
+      uint32_t checksum;
+   };
+
+   // FNV-1a
+   uint32_t checksum(const GLubyte* bytes, size_t len)
+   {
+      uint32_t h = 2166136261u;
+      for (size_t i = 0; i < len; i++)
+         h = (h ^ bytes[i]) * 16777619u;
+      return h;
+   }
+
+   // Based on reference implementation at http://mrl.nyu.edu/~perlin/noise/
+   const int perm[512] = {
+      151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,
+      69,142, 8,99,37,240,21,10,23,190,
+      6,148,247,120,234,75,0,26,197,62,94,252,219,203,
+      117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,
+      68,175,74,
+      165,71,134,139,48,27,166,77,146,158,231,83,111,229,122,60,211,133,230,220,
+      105,92,41,55,46,245,40,244, 102,143,54, 65,25,63,161,
+      1,216,80,73,209,76,132, 187,208, 89,18,169,200,196,
+      135,130,116,188,159,86,164,100,109,198,173,186,
+      3,64,52,217,226,250,124,123,5,202,38,147,118,126,255,82,85,212,207,206,59,
+      227,47,16,58,17,182,189,28,42,223,183,170,213,119,248,152,
+      2,44,154,163, 70,221,153,101,155,167, 43,172,9,129,22,39,253,
+      19,98,108,110,79,113,224, 232,178,185, 112,104,218,246,97,228,
+      251,34,242,193,238,210,144,12,191,179,162,241,
+      81,51,145,235,249,14,239,107, 49,192,214, 31,181,199,106,157,184,
+      84,204,176,115,121,50,45,127, 4,150,254,
+      138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
+      151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,
+      69,142, 8,99,37,240,21,10,23,190,
+      6,148,247,120,234,75,0,26,197,62,94,252,219,203,
+      117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,
+      68,175,74, 165,71,134,139,48,27,166,
+      77,146,158,231,83,111,229,122,60,211,133,230,220,
+      105,92,41,55,46,245,40,244, 102,143,54, 65,25,63,161,
+      1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
+      135,130,116,188,159,86,164,100,109,198,173,186,
+      3,64,52,217,226,250,124,123,
+      5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,
+      189,28,42,
+      223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167,
+      43,172,9, 129,22,39,253, 19,98,108,110,79,113,224,232,178,185,
+      112,104,218,246,97,228,
+      251,34,242,193,238,210,144,12,191,179,162,241,
+      81,51,145,235,249,14,239,107, 49,192,214, 31,181,199,106,157,184,
+      84,204,176,115,121,50,45,127, 4,150,254,
+      138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
+   };
+
+   inline float fade(float t)
+   {
+      return t * t * t * (t * (t * 6 - 15) + 10);
+   }
+
+   inline float lerp(float t, float a, float b)
+   {
+      return a + t * (b - a);
+   }
+
+   inline float grad(int hash, float x, float y, float z)
+   {
+      int h = hash & 15;
+      float u = h<8 ? x : y,
+         v = h<4 ? y : h==12||h==14 ? x : z;
+      return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
+   }
+
+   // With z always zero each gradient is just gx * x + gy * y
+   struct Gradients {
+      Gradients()
+      {
+         for (int h = 0; h < 16; h++) {
+            x[h] = grad(h, 1.0f, 0.0f, 0.0f);
+            y[h] = grad(h, 0.0f, 1.0f, 0.0f);
+         }
+      }
+
+      float x[16], y[16];
+   };
+
+   const Gradients gradients;
+
+   // Everything about a lattice column which doesn't depend on x
+   struct NoiseRow {
+      NoiseRow(float yf)
+      {
+         const float yfloor = floorf(yf);
+         Y = int(yfloor) & 255;
+         fy = yf - yfloor;
+         v = fade(fy);
+      }
+
+      // Gradient indices for the four corners of the cell at X
+      void corners(int X, int& aa, int& ba, int& ab, int& bb) const
+      {
+         const int A = perm[X] + Y, B = perm[X + 1] + Y;
+         aa = perm[perm[A]] & 15;
+         ab = perm[perm[A + 1]] & 15;
+         ba = perm[perm[B]] & 15;
+         bb = perm[perm[B + 1]] & 15;
+      }
+
+      int Y;
+      float fy, v;
+   };
+
+   // Perlin noise at (xf, row) for a single point
+   inline float noise2d(const NoiseRow& row, float xf)
+   {
+      const float xfloor = floorf(xf);
+      const float x = xf - xfloor;
+      const float y = row.fy;
+
+      int aa, ba, ab, bb;
+      row.corners(int(xfloor) & 255, aa, ba, ab, bb);
+
+      const Gradients& g = gradients;
+      const float u = fade(x);
+
+      return lerp(row.v,
+                  lerp(u, g.x[aa] * x + g.y[aa] * y,
+                          g.x[ba] * (x - 1) + g.y[ba] * y),
+                  lerp(u, g.x[ab] * x + g.y[ab] * (y - 1),
+                          g.x[bb] * (x - 1) + g.y[bb] * (y - 1)));
+   }
+
+   // Add one octave of noise to a row of n pixels at x = i * step
+   // The table lookups are done one pixel at a time but the rest of
+   // the arithmetic is done four pixels at once where SSE2 is there
+   void add_noise_row(const NoiseRow& row, float step, float scale,
+                      float* sum, int n)
+   {
+      int i = 0;
+
+#ifdef __SSE2__
+      const Gradients& g = gradients;
+
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 y = _mm_set1_ps(row.fy);
+      const __m128 y1 = _mm_set1_ps(row.fy - 1.0f);
+      const __m128 v = _mm_set1_ps(row.v);
+      const __m128 vstep = _mm_set1_ps(step);
+      const __m128 vscale = _mm_set1_ps(scale);
+      const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+      for (; i + 4 <= n; i += 4) {
+         // Coordinates are never negative so truncating is flooring
+         const __m128 xf =
+            _mm_mul_ps(_mm_add_ps(_mm_set1_ps(float(i)), lanes), vstep);
+         const __m128i xi = _mm_cvttps_epi32(xf);
+         const __m128 x = _mm_sub_ps(xf, _mm_cvtepi32_ps(xi));
+         const __m128 x1 = _mm_sub_ps(x, one);
+
+         int X[4];
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(X), xi);
+
+         float gx[4][4], gy[4][4];
+         for (int k = 0; k < 4; k++) {
+            int c[4];
+            row.corners(X[k] & 255, c[0], c[1], c[2], c[3]);
+
+            for (int j = 0; j < 4; j++) {
+               gx[j][k] = g.x[c[j]];
+               gy[j][k] = g.y[c[j]];
+            }
+         }
+
+         // Corners in the order aa, ba, ab, bb
+         const __m128 n_aa = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx[0]), x),
+                                        _mm_mul_ps(_mm_loadu_ps(gy[0]), y));
+         const __m128 n_ba = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx[1]), x1),
+                                        _mm_mul_ps(_mm_loadu_ps(gy[1]), y));
+         const __m128 n_ab = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx[2]), x),
+                                        _mm_mul_ps(_mm_loadu_ps(gy[2]), y1));
+         const __m128 n_bb = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx[3]), x1),
+                                        _mm_mul_ps(_mm_loadu_ps(gy[3]), y1));
+
+         // fade(x) = x^3 * (x * (6x - 15) + 10)
+         const __m128 x6 = _mm_mul_ps(x, _mm_set1_ps(6.0f));
+         const __m128 poly = _mm_add_ps(
+            _mm_mul_ps(x, _mm_sub_ps(x6, _mm_set1_ps(15.0f))),
+            _mm_set1_ps(10.0f));
+         const __m128 u = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(x, x), x), poly);
+
+         const __m128 lo =
+            _mm_add_ps(n_aa, _mm_mul_ps(u, _mm_sub_ps(n_ba, n_aa)));
+         const __m128 hi =
+            _mm_add_ps(n_ab, _mm_mul_ps(u, _mm_sub_ps(n_bb, n_ab)));
+         const __m128 noise =
+            _mm_add_ps(lo, _mm_mul_ps(v, _mm_sub_ps(hi, lo)));
+
+         _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i),
+                                           _mm_mul_ps(noise, vscale)));
+      }
+#endif
+
+      for (; i < n; i++)
+         sum[i] += noise2d(row, float(i) * step) * scale;
+   }
+}
+
 NoiseTexture::NoiseTexture(int size, int res, int base, int range)
    : size(size), resolution(res), base(base), range(range)
 {
@@ -55,11 +286,8 @@ NoiseTexture::NoiseTexture(int size, int res, int base, int range)
 
    const path file = cache_name();
    
-   if (exists(file)) {
-      log() << "Loading cached noise from " << file;
-
-      load_noise(pixels);
-   }
+   if (exists(file) && load_noise(pixels))
+      log() << "Loaded cached noise from " << file;
    else {
       log() << "Caching noise texture in " << file;
 
@@ -87,52 +315,118 @@ NoiseTexture::~NoiseTexture()
    glDeleteTextures(1, &texture);
 }
 
+// This thread and any loader threads which are free take rows from a
+// shared counter until there are none left. If the loader threads are
+// busy with something else this thread ends up doing all the work
 void NoiseTexture::build_noise(GLubyte* pixels)
-{   
-   const float step = float(size) / float(resolution);
+{
+   atomic<int> next_row(0);
 
-   float xf, yf;
-   int x, y;
-   for (x = 0, xf = 0.0f; x < resolution; x++, xf += step) {
-      for (y = 0, yf = 0.0f; y < resolution; y++, yf += step) {
+   vector<ThreadPool::Job<void> > helpers;
+   for (unsigned i = 0; i < loader_pool().size(); i++)
+      helpers.push_back(loader_pool().submit(function<void ()>(
+         std::bind(&NoiseTexture::build_rows, this, pixels, &next_row))));
 
-         float freq = 1.0f;
-         float sum = 0.0f;
+   build_rows(pixels, &next_row);
 
-         for (int i = 0; i < 8; i++) {
-            sum += noise2d(xf * freq, yf * freq) / freq;
-            freq *= 2.0f;
-         }
+   // Helpers that never started find no rows left so waiting only
+   // takes as long as the rows still being built
+   for (vector<ThreadPool::Job<void> >::iterator it = helpers.begin();
+        it != helpers.end(); ++it)
+      (*it).get();
+}
+
+void NoiseTexture::build_rows(GLubyte* pixels, atomic<int>* next_row) const
+{
+   const float step = float(size) / float(resolution);
+
+   vector<float> sum(resolution);
+
+   for (int y = (*next_row)++; y < resolution; y = (*next_row)++) {
+      fill(sum.begin(), sum.end(), 0.0f);
 
-         const int ni = min(255, max(0, base + int(float(range) * sum)));
-         pixels[x + (y * resolution)] = ni;
+      float freq = 1.0f;
+      for (int i = 0; i < OCTAVES; i++) {
+         const NoiseRow row(float(y) * step * freq);
+         add_noise_row(row, step * freq, 1.0f / freq, &sum[0], resolution);
+         freq *= 2.0f;
       }
-   }
 
+      GLubyte* out = pixels + y * resolution;
+      for (int x = 0; x < resolution; x++)
+         out[x] = min(255, max(0, base + int(float(range) * sum[x])));
+   }
 }
 
 void NoiseTexture::save_noise(const GLubyte* pixels)
 {
    const string fname = cache_name().string();
+   const size_t len = resolution * resolution;
    
-   ofstream f;
-   f.open(fname.c_str(), ios::out | ios::binary);
-   if (!f.is_open())
-      throw runtime_error("Failed to create " + fname);
+   NoiseHeader header;
+   memcpy(header.magic, NOISE_MAGIC, sizeof(NOISE_MAGIC));
+   header.version = NOISE_VERSION;
+   header.size = size;
+   header.resolution = resolution;
+   header.base = base;
+   header.range = range;
+   header.octaves = OCTAVES;
+   header.checksum = checksum(pixels, len);
+
+   // Write to a temporary file so a half written cache is never seen
+   const string tmp = fname + ".tmp";
+   {
+      ofstream f;
+      f.open(tmp.c_str(), ios::out | ios::binary);
+      if (!f.is_open())
+         throw runtime_error("Failed to create " + tmp);
+
+      f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      f.write(reinterpret_cast<const char*>(pixels), len);
+
+      if (!f.good())
+         throw runtime_error("Failed to write " + tmp);
+   }
 
-   f.write(reinterpret_cast<const char*>(pixels), resolution * resolution);
+   boost::filesystem::rename(tmp, fname);
 }
 
-void NoiseTexture::load_noise(GLubyte *pixels)
+// Returns false if the cache is for different settings or damaged
+bool NoiseTexture::load_noise(GLubyte *pixels)
 {
    const string fname = cache_name().string();
+   const size_t len = resolution * resolution;
 
    ifstream f;
    f.open(fname.c_str(), ios::in | ios::binary);
-   if (!f.is_open())
-      throw runtime_error("Failed to open " + fname);
+   if (!f.is_open()) {
+      warn() << "Failed to open " << fname;
+      return false;
+   }
+
+   NoiseHeader header;
+   f.read(reinterpret_cast<char*>(&header), sizeof(header));
+   
+   if (!f.good()
+       || memcmp(header.magic, NOISE_MAGIC, sizeof(NOISE_MAGIC)) != 0
+       || header.version != NOISE_VERSION
+       || header.size != size
+       || header.resolution != resolution
+       || header.base != base
+       || header.range != range
+       || header.octaves != OCTAVES) {
+      warn() << "Ignoring out of date noise cache " << fname;
+      return false;
+   }
 
-   f.read(reinterpret_cast<char*>(pixels), resolution * resolution);
+   f.read(reinterpret_cast<char*>(pixels), len);
+
+   if (size_t(f.gcount()) != len || checksum(pixels, len) != header.checksum) {
+      warn() << "Ignoring damaged noise cache " << fname;
+      return false;
+   }
+
+   return true;
 }     
 
 boost::filesystem::path NoiseTexture::cache_name()
@@ -144,89 +438,6 @@ boost::filesystem::path NoiseTexture::cache_name()
    return get_cache_dir() / ss.str();
 }
 
-static inline float fade(float t)
-{
-   return t * t * t * (t * (t * 6 - 15) + 10);
-}
-
-static inline float lerp(float t, float a, float b)
-{
-   return a + t * (b - a);
-}
-
-static inline float grad(int hash, float x, float y, float z)
-{
-   int h = hash & 15;
-   float u = h<8 ? x : y,
-      v = h<4 ? y : h==12||h==14 ? x : z;
-   return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
-}
-
-float NoiseTexture::noise2d(float x, float y) const
-{
-   // Based on reference implementation at http://mrl.nyu.edu/~perlin/noise/
-   // with zero propagated through for z
-   
-   static const int p[512] = {
-      151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,
-      69,142, 8,99,37,240,21,10,23,190,
-      6,148,247,120,234,75,0,26,197,62,94,252,219,203,
-      117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,
-      68,175,74,
-      165,71,134,139,48,27,166,77,146,158,231,83,111,229,122,60,211,133,230,220,
-      105,92,41,55,46,245,40,244, 102,143,54, 65,25,63,161,
-      1,216,80,73,209,76,132, 187,208, 89,18,169,200,196,
-      135,130,116,188,159,86,164,100,109,198,173,186,
-      3,64,52,217,226,250,124,123,5,202,38,147,118,126,255,82,85,212,207,206,59,
-      227,47,16,58,17,182,189,28,42,223,183,170,213,119,248,152,
-      2,44,154,163, 70,221,153,101,155,167, 43,172,9,129,22,39,253,
-      19,98,108,110,79,113,224, 232,178,185, 112,104,218,246,97,228,
-      251,34,242,193,238,210,144,12,191,179,162,241,
-      81,51,145,235,249,14,239,107, 49,192,214, 31,181,199,106,157,184,
-      84,204,176,115,121,50,45,127, 4,150,254,
-      138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
-      151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,
-      69,142, 8,99,37,240,21,10,23,190,
-      6,148,247,120,234,75,0,26,197,62,94,252,219,203,
-      117,35,11,32,57,177,33,88,237,149,56,87,174,20,125,136,171,168,
-      68,175,74, 165,71,134,139,48,27,166,
-      77,146,158,231,83,111,229,122,60,211,133,230,220,
-      105,92,41,55,46,245,40,244, 102,143,54, 65,25,63,161,
-      1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-      135,130,116,188,159,86,164,100,109,198,173,186,
-      3,64,52,217,226,250,124,123,
-      5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,
-      189,28,42,
-      223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167,
-      43,172,9, 129,22,39,253, 19,98,108,110,79,113,224,232,178,185,
-      112,104,218,246,97,228,
-      251,34,242,193,238,210,144,12,191,179,162,241,
-      81,51,145,235,249,14,239,107, 49,192,214, 31,181,199,106,157,184,
-      84,204,176,115,121,50,45,127, 4,150,254,
-      138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
-   };
-   
-   const int X = int(floorf(x)) & 255;
-   const int Y = int(floorf(y)) & 255;
-   
-   x -= floorf(x);
-   y -= floorf(y);
-   
-   const float u = fade(x);
-   const float v = fade(y);
-   const int A = p[X  ]+Y, AA = p[A], AB = p[A+1],
-      B = p[X+1]+Y, BA = p[B], BB = p[B+1];
-
-   return lerp(0.0f, lerp(v, lerp(u, grad(p[AA  ], x  , y  ,  0.0f ),
-                                     grad(p[BA  ], x-1, y  ,  0.0f )),
-                             lerp(u, grad(p[AB  ], x  , y-1,  0.0f ),
-                                     grad(p[BB  ], x-1, y-1,  0.0f ))),
-                     lerp(v, lerp(u, grad(p[AA+1], x  , y  , -1.0f ),
-                                     grad(p[BA+1], x-1, y  , -1.0f )),
-                             lerp(u, grad(p[AB+1], x  , y-1, -1.0f ),
-                                     grad(p[BB+1], x-1, y-1, -1.0f ))));
-}
-
 void NoiseTexture::bind()
 {
    glBindTexture(GL_TEXTURE_2D, texture);
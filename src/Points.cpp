@@ -22,6 +22,7 @@
 #include "BezierCurve.hpp"
 #include "Matrix.hpp"
 #include "OpenGLHelper.hpp"
+#include "Pool.hpp"
 
 #include <cassert>
 
@@ -42,6 +43,8 @@ public:
    float segment_length(const track::TravelToken& a_token) const;
    bool is_valid_direction(const track::Direction& a_direction) const;
    track::Connection next_position(const track::TravelToken& a_token) const;
+   void get_exits(const track::TravelToken& a_token,
+                  vector<track::Connection>& exits) const;
    void get_endpoints(PointList& a_list) const;
    void get_covers(PointList& output) const;
    void get_height_locked(PointList& output) const;
@@ -60,6 +63,9 @@ private:
    void ensure_valid_direction(track::Direction a_direction) const;
    void render_arrow() const;
 
+   track::Connection exit_position(const track::TravelToken& a_token,
+                                   bool branching) const;
+
    PointI displaced_endpoint() const;
    PointI straight_endpoint() const;
 
@@ -75,6 +81,12 @@ private:
    mutable bool state_render_hint;
 
    static const BezierCurve<float> my_curve, my_reflected_curve;
+   static const track::TrackShape shape;
+};
+
+const track::TrackShape Points::shape = {
+   track::transform_member<Points, &Points::transform>,
+   track::flat_gradient_func
 };
 
 const BezierCurve<float> Points::my_curve = make_bezier_curve(
@@ -256,8 +268,6 @@ float Points::segment_length(const track::TravelToken& a_token) const
 track::TravelToken Points::get_travel_token(track::Position position,
    track::Direction direction) const
 {
-   using namespace placeholders;
-
    ensure_valid_direction(direction);
 
    const int n_exits = position.x == myX && position.y == myY ? 2 : 1;
@@ -265,8 +275,9 @@ track::TravelToken Points::get_travel_token(track::Position position,
    track::TravelToken tok = {
       direction,
       position,
-      bind(&Points::transform, this, _1, _2),
-      track::flat_gradient_func,
+      this,
+      &shape,
+      0,
       n_exits
    };
 
@@ -408,8 +419,22 @@ bool Points::is_valid_direction(const track::Direction& a_direction) const
 
 track::Connection Points::next_position(const track::TravelToken& a_token) const
 {
-   const bool branching = state == TAKEN;
+   return exit_position(a_token, state == TAKEN);
+}
+
+void Points::get_exits(const track::TravelToken& a_token,
+                       vector<track::Connection>& exits) const
+{
+   exits.push_back(exit_position(a_token, false));
 
+   if (a_token.num_exits > 1)
+      exits.push_back(exit_position(a_token, true));
+}
+
+// Where a train leaves the points if they were in the given state
+track::Connection Points::exit_position(const track::TravelToken& a_token,
+                                        bool branching) const
+{
    if (my_axis == axis::X) {
       if (a_token.direction == -axis::X) {
          // Two possible entry points
@@ -579,5 +604,5 @@ void Points::prev_state()
 
 ITrackSegmentPtr make_points(track::Direction a_direction, bool reflect)
 {
-   return ITrackSegmentPtr(new Points(a_direction, reflect));
+   return make_pooled<Points>(a_direction, reflect);
 }
@@ -0,0 +1,137 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Preload.hpp"
+#include "IModel.hpp"
+#include "ITexture.hpp"
+#include "IScenery.hpp"
+#include "IRollingStock.hpp"
+#include "IXMLParser.hpp"
+#include "ILogger.hpp"
+
+#include <algorithm>
+
+#include <SDL_image.h>
+
+namespace {
+
+   // Set once loading has finished so queued work can be skipped
+   atomic<bool> preloading_finished(false);
+
+   // Picks out just the model file and scale from a resource's XML
+   struct ModelFinder : IXMLCallback {
+      ModelFinder() : scale(0.0f) {}
+
+      void text(const string& local_name, const string& content)
+      {
+         if (local_name == "model")
+            model_file = content;
+         else if (local_name == "scale")
+            scale = xml_attr_cast<float>(content.c_str());
+      }
+
+      bool wants_text(const string& local_name) const
+      {
+         return local_name == "model" || local_name == "scale";
+      }
+
+      string model_file;
+      float scale;
+   };
+
+   void find_and_prefetch(IResourcePtr a_res, float a_scale,
+                          Vector<float> shift, bool scale_from_xml)
+   {
+      ModelFinder finder;
+      make_fast_xml_parser()->parse(a_res->xml_file_name(), finder);
+
+      if (finder.model_file.empty())
+         return;
+
+      if (scale_from_xml && finder.scale != 0.0f)
+         a_scale = finder.scale;
+
+      prefetch_model(a_res, finder.model_file, a_scale, shift);
+   }
+
+   // Tasks which don't produce anything still need a result type
+   bool run_find_and_prefetch(IResourcePtr a_res, float a_scale,
+                              Vector<float> shift, bool scale_from_xml)
+   {
+      if (preloading_finished)
+         return true;
+
+      try {
+         find_and_prefetch(a_res, a_scale, shift, scale_from_xml);
+      }
+      catch (const exception& e) {
+         // It will be tried again on the main thread when it's loaded
+         // which will report the error properly
+         debug() << "Preloading " << a_res->name() << " failed: "
+                 << e.what();
+      }
+      return true;
+   }
+
+   void prefetch_all(const string& a_class, void (*prefetch)(IResourcePtr))
+   {
+      ResourceList list;
+      enum_resources(a_class, list);
+
+      for (ResourceList::iterator it = list.begin(); it != list.end(); ++it)
+         prefetch(*it);
+   }
+}
+
+ThreadPool& loader_pool()
+{
+   // Leave a core free for the main thread
+   static ThreadPool pool(max(thread::hardware_concurrency(), 2u) - 1);
+   return pool;
+}
+
+void prefetch_resource_model(IResourcePtr a_res, float a_scale,
+                             Vector<float> shift, bool scale_from_xml)
+{
+   loader_pool().submit(function<bool ()>(
+      bind(run_find_and_prefetch, a_res, a_scale, shift, scale_from_xml)));
+}
+
+void start_preloading()
+{
+   // libpng sets itself up the first time an image is loaded which
+   // must not happen on two threads at once
+   IMG_Init(IMG_INIT_PNG);
+
+   // The config must not be read on the loader threads
+   set_model_prefetch_budget();
+   set_texture_prefetch_budget();
+
+   prefetch_all("buildings", prefetch_building);
+   prefetch_all("trees", prefetch_tree);
+   prefetch_all("engines", prefetch_engine);
+   prefetch_all("waggons", prefetch_waggon);
+}
+
+void finish_preloading()
+{
+   preloading_finished = true;
+
+   // Models first as reading one may still start its textures
+   discard_prefetched_models();
+   discard_prefetched_textures();
+}
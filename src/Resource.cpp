@@ -19,6 +19,7 @@
 #include "ILogger.hpp"
 
 #include <map>
+#include <unordered_map>
 #include <stdexcept>
 #include <sstream>
 
@@ -30,17 +31,16 @@ using namespace boost::filesystem;
 class FilesystemResource : public IResource {
 public:
    FilesystemResource(const path& a_path)
-      : my_path(a_path)
+      : my_path(a_path),
+        my_name(a_path.filename().string()),
+        my_xml_file_name((a_path / (my_name + ".xml")).string())
    {
 
    }
 
    // IResource interface
-   string name() const { return my_path.filename().string(); }
-   string xml_file_name() const
-   {
-      return (my_path / (name() + ".xml")).string();
-   }
+   const string& name() const { return my_name; }
+   string xml_file_name() const { return my_xml_file_name; }
 
    Handle open_file(const string& a_file_name)
    {
@@ -53,6 +53,9 @@ public:
    }
 private:
    const path my_path;
+
+   // Worked out once as these are used for every lookup
+   const string my_name, my_xml_file_name;
 };
 
 IResource::Handle::Handle(const string& file_name, Mode mode)
@@ -101,20 +104,29 @@ namespace {
       NULL
    };
 
-   typedef map<string, ResourceList> ResourceMap;
+   // All the resources of one class in the order they were found
+   // and indexed by name
+   typedef unordered_map<string, IResourcePtr> ResourceIndex;
+
+   struct ResourceClass {
+      ResourceList list;
+      ResourceIndex index;
+   };
+
+   typedef map<string, ResourceClass> ResourceMap;
    ResourceMap the_resources;
 }
 
-static ResourceList& res_class_list(const string& a_class)
+static ResourceClass& res_class(const string& a_class)
 {
-   if (the_resources.find(a_class) == the_resources.end())
-      the_resources[a_class] = ResourceList();
    return the_resources[a_class];
 }
 
 static void add_resource(const string& a_class, IResourcePtr a_res)
 {
-   res_class_list(a_class).push_back(a_res);
+   ResourceClass& rc = res_class(a_class);
+   rc.list.push_back(a_res);
+   rc.index.insert(make_pair(a_res->name(), a_res));
 }
 
 static void add_resource_dir(const char* a_class, const path& p)
@@ -150,7 +162,7 @@ void init_resources()
    ss << "Found ";
 
    for (const char **it = classes; *it; ++it) {
-      const ResourceList& lst = res_class_list(*it);
+      const ResourceList& lst = res_class(*it).list;
 
       if (it != classes)
          ss << ", ";
@@ -163,7 +175,7 @@ void init_resources()
 // Find all the resources of the given type
 void enum_resources(const string& a_class, ResourceList& a_list)
 {
-   ResourceList& lst = res_class_list(a_class);
+   ResourceList& lst = res_class(a_class).list;
    copy(lst.begin(), lst.end(), back_inserter(a_list));
 }
 
@@ -172,13 +184,13 @@ void enum_resources(const string& a_class, ResourceList& a_list)
 static IResourcePtr maybe_find_resource(const string& a_res_id,
                                         const string& a_class)
 {
-   ResourceList& rlist = res_class_list(a_class);
-   for (ResourceListIt it = rlist.begin(); it != rlist.end(); ++it) {
-      if ((*it)->name() == a_res_id)
-         return *it;
-   }
+   ResourceMap::const_iterator rc = the_resources.find(a_class);
+   if (rc == the_resources.end())
+      return IResourcePtr();
 
-   return IResourcePtr();
+   const ResourceIndex& index = (*rc).second.index;
+   ResourceIndex::const_iterator it = index.find(a_res_id);
+   return it == index.end() ? IResourcePtr() : (*it).second;
 }
 
 // Find a resource or throw an exception on failure
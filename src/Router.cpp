@@ -0,0 +1,268 @@
+//
+//  Copyright (C) 2011  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "IRouter.hpp"
+#include "ILogger.hpp"
+#include "LRUCache.hpp"
+
+#include <queue>
+#include <limits>
+#include <cassert>
+
+// Rather than searching from the source each time, run Dijkstra's
+// algorithm backwards from the destination once. Every later query
+// for that destination then just follows the cheapest arc at each
+// node, which only costs the length of the route. Each table costs four
+// bytes per node so only the most recently used ones are kept
+class Router : public IRouter {
+public:
+   Router(ITrackGraphPtr graph, unsigned cache_tables);
+
+   // IRouter interface
+   bool route(unsigned from, unsigned to, Route& r);
+   bool route(unsigned from, IStationPtr to, Route& r);
+   float distance(unsigned from, unsigned to);
+   void set_points(const Route& r) const;
+   unsigned cache_hits() const { return hits; }
+   unsigned cache_misses() const { return misses; }
+
+private:
+   typedef vector<float> DistanceTable;
+   typedef shared_ptr<DistanceTable> DistanceTablePtr;
+
+   DistanceTablePtr distances_to(unsigned to);
+   void check_revision();
+   void build_reverse();
+   void size_cache();
+
+   ITrackGraphPtr graph;
+   unsigned revision;
+
+   // Zero to keep a table for every station entry
+   unsigned cache_tables;
+   unsigned hits, misses;
+
+   // Arcs entering each node in compressed sparse row form
+   vector<unsigned> in_offsets;
+   vector<const graph::Arc*> in_arcs;
+
+   // Distance from every node to the key node
+   LRUCache<DistanceTable, unsigned> cache;
+
+   static const float INFINITE;
+   static const unsigned MIN_CACHE_TABLES;
+};
+
+const float Router::INFINITE = numeric_limits<float>::infinity();
+const unsigned Router::MIN_CACHE_TABLES = 16;
+
+Router::Router(ITrackGraphPtr a_graph, unsigned a_cache_tables)
+   : graph(a_graph), revision(a_graph->revision()),
+     cache_tables(a_cache_tables), hits(0), misses(0), cache(0)
+{
+   build_reverse();
+   size_cache();
+}
+
+// Throw away everything we know if the track has changed
+void Router::check_revision()
+{
+   if (graph->revision() != revision) {
+      revision = graph->revision();
+      cache.clear();
+      build_reverse();
+      size_cache();
+   }
+}
+
+// Trains mostly route to stations so by default there is room for
+// the table of every way into one
+void Router::size_cache()
+{
+   unsigned tables = cache_tables;
+
+   if (tables == 0) {
+      for (unsigned n = 0; n < graph->node_count(); n++) {
+         if (graph->node(n).type == graph::NODE_STATION)
+            tables++;
+      }
+
+      tables = max(tables, MIN_CACHE_TABLES);
+   }
+
+   cache.set_budget(size_t(tables) * graph->node_count() * sizeof(float));
+}
+
+void Router::build_reverse()
+{
+   const unsigned n_nodes = graph->node_count();
+
+   in_offsets.assign(n_nodes + 1, 0);
+
+   for (unsigned n = 0; n < n_nodes; n++) {
+      for (const graph::Arc* a = graph->arcs_begin(n);
+           a != graph->arcs_end(n); ++a)
+         in_offsets[a->end + 1]++;
+   }
+
+   for (unsigned n = 0; n < n_nodes; n++)
+      in_offsets[n + 1] += in_offsets[n];
+
+   in_arcs.resize(in_offsets[n_nodes]);
+
+   vector<unsigned> fill(in_offsets.begin(), in_offsets.end() - 1);
+   for (unsigned n = 0; n < n_nodes; n++) {
+      for (const graph::Arc* a = graph->arcs_begin(n);
+           a != graph->arcs_end(n); ++a)
+         in_arcs[fill[a->end]++] = a;
+   }
+}
+
+Router::DistanceTablePtr Router::distances_to(unsigned to)
+{
+   check_revision();
+
+   DistanceTablePtr cached = cache.find(to);
+   if (cached) {
+      hits++;
+      return cached;
+   }
+
+   misses++;
+
+   assert(to < graph->node_count());
+
+   DistanceTablePtr table(new DistanceTable(graph->node_count(), INFINITE));
+   DistanceTable& dist = *table;
+
+   typedef pair<float, unsigned> QueueEntry;
+   priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry> > queue;
+
+   dist[to] = 0.0f;
+   queue.push(make_pair(0.0f, to));
+
+   while (!queue.empty()) {
+      const QueueEntry top = queue.top();
+      queue.pop();
+
+      const unsigned n = top.second;
+      if (top.first > dist[n])
+         continue;  // Already found a shorter way
+
+      for (unsigned i = in_offsets[n]; i < in_offsets[n + 1]; i++) {
+         const graph::Arc* a = in_arcs[i];
+         const float d = dist[n] + a->length;
+         if (d < dist[a->start]) {
+            dist[a->start] = d;
+            queue.push(make_pair(d, a->start));
+         }
+      }
+   }
+
+   cache.insert(to, table, dist.size() * sizeof(float));
+   return table;
+}
+
+float Router::distance(unsigned from, unsigned to)
+{
+   DistanceTablePtr table = distances_to(to);
+   const DistanceTable& dist = *table;
+   assert(from < dist.size());
+
+   return dist[from] == INFINITE ? -1.0f : dist[from];
+}
+
+bool Router::route(unsigned from, unsigned to, Route& r)
+{
+   DistanceTablePtr table = distances_to(to);
+   const DistanceTable& dist = *table;
+   assert(from < dist.size());
+
+   r.clear();
+
+   if (dist[from] == INFINITE)
+      return false;
+
+   unsigned n = from;
+   while (n != to) {
+      const graph::Arc* best = NULL;
+      float best_dist = INFINITE;
+
+      for (const graph::Arc* a = graph->arcs_begin(n);
+           a != graph->arcs_end(n); ++a) {
+         const float d = a->length + dist[a->end];
+         if (d < best_dist) {
+            best = a;
+            best_dist = d;
+         }
+      }
+
+      assert(best);
+      r.push_back(*best);
+      n = best->end;
+   }
+
+   return true;
+}
+
+bool Router::route(unsigned from, IStationPtr to, Route& r)
+{
+   // A station may be entered from either end
+   unsigned best = 0;
+   float best_dist = INFINITE;
+
+   for (unsigned n = 0; n < graph->node_count(); n++) {
+      if (graph->node(n).station != to)
+         continue;
+
+      const float d = (*distances_to(n))[from];
+      if (d < best_dist) {
+         best = n;
+         best_dist = d;
+      }
+   }
+
+   if (best_dist == INFINITE) {
+      r.clear();
+      return false;
+   }
+   else
+      return route(from, best, r);
+}
+
+void Router::set_points(const Route& r) const
+{
+   for (Route::const_iterator it = r.begin(); it != r.end(); ++it) {
+      const graph::Node& n = graph->node((*it).start);
+      if (n.type != graph::NODE_POINTS)
+         continue;
+
+      const track::TravelToken token =
+         n.track->get_travel_token(n.entry.first, n.entry.second);
+
+      // There are only two states so one of these must be right
+      if (n.track->next_position(token) != (*it).exit)
+         n.track->next_state();
+      if (n.track->next_position(token) != (*it).exit)
+         n.track->prev_state();
+   }
+}
+
+IRouterPtr make_router(ITrackGraphPtr graph, unsigned cache_tables)
+{
+   return IRouterPtr(new Router(graph, cache_tables));
+}
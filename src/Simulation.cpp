@@ -0,0 +1,201 @@
+//
+//  Copyright (C) 2013  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Simulation.hpp"
+#include "ITrain.hpp"
+#include "ITrackEvents.hpp"
+#include "ILogger.hpp"
+
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <iomanip>
+
+#include <boost/cstdint.hpp>
+
+namespace {
+
+   typedef chrono::steady_clock Clock;
+
+   // Length of each simulation step in milliseconds
+   const int TICK_MS = 20;
+
+   // How far ahead to search on each tick, as Game::look_ahead does
+   const unsigned MAX_LOOK = 10;
+
+   double seconds_since(Clock::time_point start)
+   {
+      return chrono::duration<double>(Clock::now() - start).count();
+   }
+
+   // Accumulates a 64-bit FNV-1a hash of the simulation state
+   class Checksum {
+   public:
+      Checksum() : hash(14695981039346656037ULL) {}
+
+      template <class T>
+      void add(const T& t)
+      {
+         const unsigned char* p = reinterpret_cast<const unsigned char*>(&t);
+         for (size_t i = 0; i < sizeof(T); i++) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+         }
+      }
+
+      boost::uint64_t value() const { return hash; }
+   private:
+      boost::uint64_t hash;
+   };
+
+   struct SimTrain {
+      ITrainPtr train;
+      bool crashed;
+   };
+
+   // One if there is a station, points or dead end close in front
+   // of the train
+   int look_ahead(ITrackEventsPtr events, const SimTrain& t)
+   {
+      const TrackEvent& e = events->next_event(
+         make_pair(t.train->tile(), t.train->direction()));
+
+      return e.status != TRACK_OK && e.segments < MAX_LOOK ? 1 : 0;
+   }
+
+   // Put a new train at the map's start location with the brake off
+   // and full throttle unless the last one is still in the way
+   bool spawn_train(IMapPtr map, vector<SimTrain>& trains)
+   {
+      SimTrain t = { ITrainPtr(), false };
+      try {
+         t.train = make_headless_train(map);
+      }
+      catch (const runtime_error& e) {
+         return false;
+      }
+
+      IControllerPtr c = t.train->controller();
+      c->act_on(BRAKE_TOGGLE);
+      for (int j = 0; j < 10; j++)
+         c->act_on(THROTTLE_UP);
+
+      trains.push_back(t);
+      return true;
+   }
+}
+
+void run_simulation(const string& a_map_res, int a_trains, int a_ticks,
+                    ostream& a_report)
+{
+   if (a_trains <= 0 || a_ticks <= 0)
+      throw runtime_error("Simulation needs at least one train and tick");
+
+   const Clock::time_point load_start = Clock::now();
+
+   IMapPtr map = load_map(a_map_res);
+   ITrackEventsPtr events = make_track_events(map);
+
+   const double load_time = seconds_since(load_start);
+
+   log() << "Simulating " << a_trains << " trains for "
+         << a_ticks << " ticks";
+
+   // Trains hold the track they are on so each one waits at the
+   // start until the one before has moved off
+   vector<SimTrain> trains;
+   trains.reserve(a_trains);
+
+   double spawn_time = 0.0, update_time = 0.0, look_time = 0.0;
+   int crashed = 0, features = 0;
+
+   const Clock::time_point run_start = Clock::now();
+
+   for (int tick = 0; tick < a_ticks; tick++) {
+      Clock::time_point phase_start = Clock::now();
+
+      if (trains.size() < static_cast<size_t>(a_trains))
+         spawn_train(map, trains);
+
+      spawn_time += seconds_since(phase_start);
+      phase_start = Clock::now();
+
+      for (vector<SimTrain>::iterator it = trains.begin();
+           it != trains.end(); ++it) {
+         if ((*it).crashed)
+            continue;
+
+         try {
+            (*it).train->update(TICK_MS);
+         }
+         catch (const runtime_error& e) {
+            // Trains that run off the end of the line or into another
+            // train stay where they are
+            debug() << "Train crashed on tick " << tick << ": " << e.what();
+            (*it).crashed = true;
+            crashed++;
+         }
+      }
+
+      update_time += seconds_since(phase_start);
+      phase_start = Clock::now();
+
+      for (vector<SimTrain>::const_iterator it = trains.begin();
+           it != trains.end(); ++it) {
+         if (!(*it).crashed)
+            features += look_ahead(events, *it);
+      }
+
+      look_time += seconds_since(phase_start);
+   }
+
+   const double run_time = seconds_since(run_start);
+
+   Checksum sum;
+   for (vector<SimTrain>::const_iterator it = trains.begin();
+        it != trains.end(); ++it) {
+      const track::Position pos = (*it).train->tile();
+      const track::Direction dir = (*it).train->direction();
+      const double speed = (*it).train->speed();
+
+      sum.add(pos.x);
+      sum.add(pos.y);
+      sum.add(dir.x);
+      sum.add(dir.z);
+      sum.add(speed);
+      sum.add((*it).crashed);
+   }
+
+   const double per_tick = 1.0e6 / a_ticks;
+
+   a_report << fixed << setprecision(3)
+            << "trains:      " << trains.size() << " of "
+            << a_trains << endl
+            << "ticks:       " << a_ticks
+            << " (" << TICK_MS << "ms each)" << endl
+            << "crashed:     " << crashed << endl
+            << "features:    " << features << endl
+            << "ticks/sec:   " << (a_ticks / run_time) << endl
+            << "load:        " << (load_time * 1000.0) << "ms" << endl
+            << "spawn:       " << (spawn_time * 1000.0) << "ms" << endl
+            << "update:      " << (update_time * 1000.0) << "ms ("
+            << (update_time * per_tick) << "us/tick)" << endl
+            << "look ahead:  " << (look_time * 1000.0) << "ms ("
+            << (look_time * per_tick) << "us/tick)" << endl
+            << "checksum:    " << hex << setw(16) << setfill('0')
+            << sum.value() << dec << setfill(' ') << endl;
+}
@@ -24,6 +24,7 @@
 #include "OpenGLHelper.hpp"
 #include "ILogger.hpp"
 #include "Matrix.hpp"
+#include "Pool.hpp"
 
 #include <cassert>
 #include <stdexcept>
@@ -47,6 +48,11 @@ public:
       track::Direction dir) const;
    bool is_valid_direction(const track::Direction& dir) const;
    track::Connection next_position(const track::TravelToken& token) const;
+   void get_exits(const track::TravelToken& token,
+                  vector<track::Connection>& exits) const
+   {
+      exits.push_back(next_position(token));
+   }
    void get_endpoints(vector<Point<int> >& output) const;
    void get_covers(vector<Point<int> >& output) const {};
    void get_height_locked(vector<Point<int> >& output) const;
@@ -71,6 +77,13 @@ private:
    track::Direction axis;
    float length, y_offset;
    BezierCurve<float> curve;
+
+   static const track::TrackShape shape;
+};
+
+const track::TrackShape SlopeTrack::shape = {
+   track::transform_member<SlopeTrack, &SlopeTrack::transform>,
+   track::gradient_member<SlopeTrack, &SlopeTrack::gradient>
 };
 
 SlopeTrack::SlopeTrack(track::Direction axis, Vector<float> slope,
@@ -187,15 +200,14 @@ track::Connection SlopeTrack::next_position(
 track::TravelToken SlopeTrack::get_travel_token(track::Position pos,
       track::Direction dir) const
 {
-   using namespace placeholders;
-
    ensure_valid_direction(dir);
 
    track::TravelToken tok = {
       dir,
       pos,
-      bind(&SlopeTrack::transform, this, _1, _2),
-      bind(&SlopeTrack::gradient, this, _1, _2),
+      this,
+      &shape,
+      0,
       1
    };
    return tok;
@@ -286,6 +298,5 @@ xml::element SlopeTrack::to_xml() const
 ITrackSegmentPtr make_slope_track(track::Direction axis, Vector<float> slope,
    Vector<float> slope_before, Vector<float> slope_after)
 {
-   return ITrackSegmentPtr(
-      new SlopeTrack(axis, slope, slope_before, slope_after));
+   return make_pooled<SlopeTrack>(axis, slope, slope_before, slope_after);
 }
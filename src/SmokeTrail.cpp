@@ -15,13 +15,21 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+
 #include "ISmokeTrail.hpp"
-#include "IBillboard.hpp"
+#include "ITexture.hpp"
 #include "Random.hpp"
 
-#include <list>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include <GL/gl.h>
 
 // Concrete implementation of smoke trails
+// Particles are kept in fixed size arrays in the order they were
+// made and as they all live for the same time the dead ones are
+// always at the front
 class SmokeTrail : public ISmokeTrail {
 public:
    SmokeTrail();
@@ -33,23 +41,24 @@ public:
    void update(int a_delta);
    void set_delay(int a_delay) { my_spawn_delay = a_delay; }
    void set_velocity(float x, float y, float z);
-   
-   // A single smoke particle
-   struct Particle {
-      float x, y, z;
-      float xv, yv, zv;
-      float scale;
-      float r, g, b, a;
-      bool appearing;
 
-      IBillboardPtr billboard;
-   };
-   
+   static void render_saved();
+
+   // Enough for the shortest delay with a few to spare
+   enum { CAPACITY = 128 };
+
 private:
    void new_particle();
-   bool move_particle(Particle& a_particle, int a_delta);
-   
-   list<Particle> particles;
+   void move_particles(float time);
+
+   // Live particles are [first, first + count)
+   unsigned first, count;
+
+   float px[CAPACITY], py[CAPACITY], pz[CAPACITY];
+   float vx[CAPACITY], vy[CAPACITY], vz[CAPACITY];
+   float age[CAPACITY], alpha[CAPACITY];
+   float scale[CAPACITY], shade[CAPACITY];
+
    float myX, myY, myZ;
 
    ITexturePtr particle_tex;
@@ -59,68 +68,95 @@ private:
 
    // Velocity at which the emitter is moving
    float myXSpeed, myYSpeed, myZSpeed;
+
+   // Trails to draw at the end of this frame
+   static vector<const SmokeTrail*> to_draw;
 };
 
-SmokeTrail::SmokeTrail()
-   : myX(0.0f), myY(0.0f), myZ(0.0f),
-     my_spawn_delay(500), my_spawn_counter(0),
-     myXSpeed(0.0f), myYSpeed(0.0f), myZSpeed(0.0f)
-{
-   particle_tex = load_texture("images/smoke_particle.png");
-}
+vector<const SmokeTrail*> SmokeTrail::to_draw;
 
-// Returns true if the particle is dead
-bool SmokeTrail::move_particle(Particle& p, int a_delta)
-{
+namespace {
    const float y_speed = 0.4f;
    const float growth = 0.3f;
-   const float decay = 0.3f;
+   const float disappear = 0.3f;
    const float appear = 4.0f;
    const float slowdown = 0.1f;
    const float x_wind = 0.02f;
    const float z_wind = 0.01f;
+   const float max_alpha = 0.8f;
 
-   const float time = static_cast<float>(a_delta) / 1000.0f;
-   
-   p.x += p.xv + (x_wind * time);
-   p.y += p.yv + (y_speed * time);
-   p.z += p.zv + (z_wind * time);
-
-   p.xv = max(p.xv - (slowdown * time), 0.0f);
-   p.yv = max(p.yv - (slowdown * time), 0.0f);
-   p.zv = max(p.zv - (slowdown * time), 0.0f);   
-   
-   p.scale += growth * time;
-
-   p.billboard->set_position(p.x, p.y, p.z);
-   p.billboard->set_colour(p.r, p.g, p.b, p.a);
-   p.billboard->set_scale(p.scale);
-   
-   const float maxA = 0.8f;
-   if (p.appearing) {
-      if ((p.a += appear * time) >= maxA) {
-         p.a = maxA;
-         p.appearing = false;
+   // Particles fade in to max_alpha then fade out again
+   const float fade_in_time = max_alpha / appear;
+   const float lifetime = fade_in_time + max_alpha / disappear;
+
+   // Corner of a particle quad as drawn
+   struct SmokeVertex {
+      float u, v;
+      float r, g, b, a;
+      float x, y, z;
+   };
+
+   // A particle copied out of its trail to be sorted
+   struct Sprite {
+      float x, y, z;
+      float w;   // Half the width
+      float shade, alpha;
+      float depth;
+   };
+
+   struct CmpDepth {
+      bool operator()(const Sprite& lhs, const Sprite& rhs) const
+      {
+         return lhs.depth < rhs.depth;
       }
-      return false;
-   }
-   else {
-      // Kill the particle if it becomes invisible
-      return (p.a -= decay * time) <= 0.0f;
+   };
+
+   // Reused every frame to avoid allocating
+   vector<Sprite> sprites;
+   vector<SmokeVertex> batch;
+}
+
+SmokeTrail::SmokeTrail()
+   : first(0), count(0),
+     myX(0.0f), myY(0.0f), myZ(0.0f),
+     my_spawn_delay(500), my_spawn_counter(0),
+     myXSpeed(0.0f), myYSpeed(0.0f), myZSpeed(0.0f)
+{
+   particle_tex = load_texture("images/smoke_particle.png");
+}
+
+// Kept free of branches so the compiler can vectorise it
+void SmokeTrail::move_particles(float time)
+{
+   const unsigned end = first + count;
+   for (unsigned i = first; i < end; i++) {
+      px[i] += vx[i] + (x_wind * time);
+      py[i] += vy[i] + (y_speed * time);
+      pz[i] += vz[i] + (z_wind * time);
+
+      vx[i] = max(vx[i] - (slowdown * time), 0.0f);
+      vy[i] = max(vy[i] - (slowdown * time), 0.0f);
+      vz[i] = max(vz[i] - (slowdown * time), 0.0f);
+
+      scale[i] += growth * time;
+      age[i] += time;
+
+      // The lines for fading in and out cross at max_alpha
+      alpha[i] = min(appear * age[i],
+                     max_alpha - disappear * (age[i] - fade_in_time));
    }
 }
 
 void SmokeTrail::update(int a_delta)
 {
-   // Move the existing particles
-   list<Particle>::iterator it = particles.begin();
-   while (it != particles.end()) {
-      if (move_particle(*it, a_delta))
-         it = particles.erase(it);
-      else
-         ++it;
+   move_particles(static_cast<float>(a_delta) / 1000.0f);
+
+   // Kill particles which have become invisible
+   while (count > 0 && age[first] >= lifetime) {
+      first++;
+      count--;
    }
-   
+
    my_spawn_counter -= a_delta;
 
    if (my_spawn_counter <= 0) {
@@ -139,34 +175,120 @@ void SmokeTrail::new_particle()
    // Random number generator for position variance
    static Normal<float> pos_rand(0.0f, 0.07f);
 
-   const float col = 0.7f + colour_rand();
+   if (count == CAPACITY)
+      return;
+   else if (first + count == CAPACITY) {
+      // Move the live particles back to the start
+      float* arrays[] = { px, py, pz, vx, vy, vz, age, alpha, scale, shade };
+      for (size_t i = 0; i < sizeof(arrays) / sizeof(float*); i++)
+         memmove(arrays[i], arrays[i] + first, count * sizeof(float));
 
-   const float dx = pos_rand();
-   const float dz = pos_rand();
-   
-   Particle p = {
-      myX + dx, myY, myZ + dz,      // Position
-      myXSpeed, myYSpeed, myZSpeed, // Speed
-      0.4f,                         // Scale
-      col, col, col,                // Colour
-      0.0f,                         // Alpha
-      true,                         // Appearing
+      first = 0;
+   }
 
-      make_spherical_billboard(particle_tex)
-   };
+   const unsigned i = first + count++;
+
+   px[i] = myX + pos_rand();
+   py[i] = myY;
+   pz[i] = myZ + pos_rand();
 
-   p.billboard->set_position(p.x, p.y, p.z);
-   p.billboard->set_colour(p.r, p.g, p.b, p.a);
-   p.billboard->set_scale(p.scale);
-   
-   particles.push_back(p);
+   vx[i] = myXSpeed;
+   vy[i] = myYSpeed;
+   vz[i] = myZSpeed;
+
+   age[i] = 0.0f;
+   alpha[i] = 0.0f;
+   scale[i] = 0.4f;
+   shade[i] = 0.7f + colour_rand();
 }
 
 void SmokeTrail::render() const
-{   
-   for (list<Particle>::const_iterator it = particles.begin();
-        it != particles.end(); ++it)
-      (*it).billboard->render();
+{
+   // Remember to draw this trail at the end of the frame
+   if (count > 0)
+      to_draw.push_back(this);
+}
+
+// Draw the particles of every trail saved this frame as one batch of
+// quads facing the camera, sorted back to front
+void SmokeTrail::render_saved()
+{
+   if (to_draw.empty())
+      return;
+
+   // The rows of the camera matrix give its right, up and forward
+   // vectors in world coordinates
+   float m[16];
+   glGetFloatv(GL_MODELVIEW_MATRIX, m);
+
+   sprites.clear();
+   for (vector<const SmokeTrail*>::const_iterator it = to_draw.begin();
+        it != to_draw.end(); ++it) {
+      const SmokeTrail& t = **it;
+      for (unsigned i = t.first; i < t.first + t.count; i++) {
+         const Sprite s = {
+            t.px[i], t.py[i], t.pz[i],
+            t.scale[i] / 2.0f, t.shade[i], t.alpha[i],
+            m[2] * t.px[i] + m[6] * t.py[i] + m[10] * t.pz[i]
+         };
+         sprites.push_back(s);
+      }
+   }
+
+   // Furthest away has the most negative depth
+   sort(sprites.begin(), sprites.end(), CmpDepth());
+
+   const float corners[4][4] = {
+      // u, v, right, up
+      { 1.0f, 0.0f, 1.0f, 1.0f },
+      { 0.0f, 0.0f, -1.0f, 1.0f },
+      { 0.0f, 1.0f, -1.0f, -1.0f },
+      { 1.0f, 1.0f, 1.0f, -1.0f }
+   };
+
+   batch.resize(sprites.size() * 4);
+   for (size_t i = 0; i < sprites.size(); i++) {
+      const Sprite& s = sprites[i];
+      SmokeVertex* v = &batch[i * 4];
+
+      for (int c = 0; c < 4; c++) {
+         const float r = corners[c][2] * s.w, u = corners[c][3] * s.w;
+
+         v[c].u = corners[c][0];
+         v[c].v = corners[c][1];
+         v[c].r = v[c].g = v[c].b = s.shade;
+         v[c].a = s.alpha;
+         v[c].x = s.x + r * m[0] + u * m[1];
+         v[c].y = s.y + r * m[4] + u * m[5];
+         v[c].z = s.z + r * m[8] + u * m[9];
+      }
+   }
+
+   glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+   glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+   glEnable(GL_BLEND);
+   glEnable(GL_TEXTURE_2D);
+   glDisable(GL_LIGHTING);
+   glDepthMask(GL_FALSE);
+
+   to_draw.front()->particle_tex->bind();
+
+   glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+   glTexCoordPointer(2, GL_FLOAT, sizeof(SmokeVertex), &batch[0].u);
+
+   glEnableClientState(GL_COLOR_ARRAY);
+   glColorPointer(4, GL_FLOAT, sizeof(SmokeVertex), &batch[0].r);
+
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glVertexPointer(3, GL_FLOAT, sizeof(SmokeVertex), &batch[0].x);
+
+   glDrawArrays(GL_QUADS, 0, batch.size());
+
+   glPopClientAttrib();
+   glPopAttrib();
+
+   to_draw.clear();
 }
 
 void SmokeTrail::set_position(float x, float y, float z)
@@ -187,3 +309,8 @@ ISmokeTrailPtr make_smoke_trail()
 {
    return ISmokeTrailPtr(new SmokeTrail);
 }
+
+void render_smoke_trails()
+{
+   SmokeTrail::render_saved();
+}
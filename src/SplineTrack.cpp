@@ -21,8 +21,10 @@
 #include "OpenGLHelper.hpp"
 #include "ILogger.hpp"
 #include "Matrix.hpp"
+#include "Pool.hpp"
 
 #include <stdexcept>
+#include <algorithm>
 
 // A generic track implementation based on Bezier curves
 class SplineTrack : public ITrackSegment,
@@ -40,6 +42,11 @@ public:
    float segment_length(const track::TravelToken& token) const;
    bool is_valid_direction(const track::Direction& dir) const;
    track::Connection next_position(const track::TravelToken& token) const;
+   void get_exits(const track::TravelToken& token,
+                  vector<track::Connection>& exits) const
+   {
+      exits.push_back(next_position(token));
+   }
    void get_endpoints(PointList& output) const;
    void get_covers(PointList& output) const;
    void get_height_locked(PointList& output) const;
@@ -57,12 +64,12 @@ public:
 private:
    typedef vector<Point<float> > Polygon;
    void bounding_polygon(Polygon& poly) const;
-   static bool point_in_polygon(const Polygon& poly, Point<float> p);
+   static void scan_polygon(const Polygon& poly, float off,
+                            PointI lo, PointI hi, PointList& output);
 
    float extend_from_center(track::Direction dir) const;
    void ensure_valid_direction(track::Direction dir) const;
-   void transform(const track::TravelToken& token,
-                  float delta, bool backwards) const;
+   void transform(const track::TravelToken& token, float delta) const;
    float rotation_at(float delta) const;
 
    BezierCurve<float> curve;
@@ -72,16 +79,33 @@ private:
    float height;
    VectorI delta;
    track::Direction entry_dir, exit_dir;
-   Polygon bounds;
+
+   // Tiles under the track relative to the origin
+   struct Footprint {
+      Polygon bounds;
+      PointList covers, height_locked;
+   };
+   const Footprint* footprint;
 
    typedef tuple<VectorI,
                  track::Direction,
                  track::Direction> Parameters;
    typedef map<Parameters, IMeshBufferPtr> MeshCache;
    static MeshCache mesh_cache;
+
+   typedef map<Parameters, Footprint> FootprintCache;
+   static FootprintCache footprint_cache;
+
+   static const track::TrackShape shape;
 };
 
 SplineTrack::MeshCache SplineTrack::mesh_cache;
+SplineTrack::FootprintCache SplineTrack::footprint_cache;
+
+const track::TrackShape SplineTrack::shape = {
+   track::transform_member<SplineTrack, &SplineTrack::transform>,
+   track::flat_gradient_func
+};
 
 SplineTrack::SplineTrack(VectorI delta,
                          track::Direction entry_dir,
@@ -126,7 +150,33 @@ SplineTrack::SplineTrack(VectorI delta,
    else
       rail_buf = (*it).second;
 
-   bounding_polygon(bounds);
+   FootprintCache::iterator fit = footprint_cache.find(parms);
+   if (fit == footprint_cache.end()) {
+      Footprint& f = footprint_cache[parms];
+      bounding_polygon(f.bounds);
+
+      const PointI lo = make_point(min(0, delta.x), min(0, delta.y));
+      const PointI hi = make_point(max(0, delta.x) + 1, max(0, delta.y) + 1);
+
+      // Covers are tiles whose centre is under the track except for
+      // the two endpoints
+      PointList centres;
+      scan_polygon(f.bounds, 0.0f, lo, hi, centres);
+
+      const PointI end = make_point(delta.x, delta.y);
+      for (PointList::const_iterator p = centres.begin();
+           p != centres.end(); ++p) {
+         if (*p != make_point(0, 0) && *p != end)
+            f.covers.push_back(*p);
+      }
+
+      // Height locked points are tile corners under the track
+      scan_polygon(f.bounds, -0.5f, lo, hi, f.height_locked);
+
+      footprint = &f;
+   }
+   else
+      footprint = &(*fit).second;
 }
 
 float SplineTrack::extend_from_center(track::Direction dir) const
@@ -187,8 +237,8 @@ void SplineTrack::render() const
    glColor3f(0.1f, 0.1f, 0.8f);
 
    glBegin(GL_LINE_LOOP);
-   for (Polygon::const_iterator it = bounds.begin();
-        it != bounds.end();
+   for (Polygon::const_iterator it = footprint->bounds.begin();
+        it != footprint->bounds.end();
         ++it)
       glVertex3f((*it).x, 0.1f, (*it).y);
    glEnd();
@@ -269,42 +319,52 @@ void SplineTrack::get_endpoints(PointList& output) const
 
 void SplineTrack::get_covers(PointList& output) const
 {
-   const Point<float> off = make_point(0.5f, 0.5f);
-
-   for (int x = min(0, delta.x); x <= max(0, delta.x) + 1; x++) {
-      for (int y = min(0, delta.y); y <= max(0, delta.y) + 1; y++) {
-         PointI p = make_point(x, y);
-
-         const bool is_origin = p == make_point(0, 0);
-         const bool is_delta = p == make_point(delta.x, delta.y);
-
-         if (point_in_polygon(bounds, point_cast<float>(p) + off)
-             && !(is_origin || is_delta))
-            output.push_back(p + origin);
-      }
-   }
+   for (PointList::const_iterator it = footprint->covers.begin();
+        it != footprint->covers.end(); ++it)
+      output.push_back(*it + origin);
 }
 
-bool SplineTrack::point_in_polygon(const Polygon& poly, Point<float> p)
+// Add every grid point (x + off, y + off) between lo and hi which is
+// inside the polygon. The polygon edges are intersected with each row
+// once rather than testing every point against every edge
+void SplineTrack::scan_polygon(const Polygon& poly, float off,
+                               PointI lo, PointI hi, PointList& output)
 {
-   bool odd_nodes = false;
    const int n_sides = poly.size();
-   int j = n_sides - 1;
+   vector<float> crossings;
+   PointList inside;
+
+   for (int y = lo.y; y <= hi.y; y++) {
+      const float fy = static_cast<float>(y) + off;
+
+      crossings.clear();
 
-   const float x = p.x - 0.5f;
-   const float y = p.y - 0.5f;
+      int j = n_sides - 1;
+      for (int i = 0; i < n_sides; i++) {
+         if ((poly[i].y < fy && poly[j].y >= fy)
+             || (poly[j].y < fy && poly[i].y >= fy))
+            crossings.push_back(
+               poly[i].x + (fy - poly[i].y)/(poly[j].y-poly[i].y)*(poly[j].x-poly[i].x));
+         j = i;
+      }
+
+      sort(crossings.begin(), crossings.end());
 
-   for (int i = 0; i < n_sides; i++) {
-      if ((poly[i].y < y && poly[j].y >= y)
-          || (poly[j].y < y && poly[i].y >= y)) {
+      // Even-odd rule: inside if an odd number of edges are to the left
+      vector<float>::const_iterator left = crossings.begin();
+      for (int x = lo.x; x <= hi.x; x++) {
+         const float fx = static_cast<float>(x) + off;
+         while (left != crossings.end() && *left < fx)
+            ++left;
 
-         if (poly[i].x + (y - poly[i].y)/(poly[j].y-poly[i].y)*(poly[j].x-poly[i].x) < x)
-            odd_nodes = !odd_nodes;
+         if ((left - crossings.begin()) % 2 == 1)
+            inside.push_back(make_point(x, y));
       }
-      j = i;
    }
 
-   return odd_nodes;
+   // Keep the same column-major order as testing tile by tile
+   sort(inside.begin(), inside.end());
+   output.insert(output.end(), inside.begin(), inside.end());
 }
 
 void SplineTrack::bounding_polygon(Polygon& poly) const
@@ -325,14 +385,9 @@ void SplineTrack::bounding_polygon(Polygon& poly) const
 
 void SplineTrack::get_height_locked(PointList& output) const
 {
-   for (int x = min(0, delta.x); x <= max(0, delta.x) + 1; x++) {
-      for (int y = min(0, delta.y); y <= max(0, delta.y) + 1; y++) {
-
-         PointI p = make_point(x, y);
-         if (point_in_polygon(bounds, point_cast<float>(p)))
-            output.push_back(p + origin);
-      }
-   }
+   for (PointList::const_iterator it = footprint->height_locked.begin();
+        it != footprint->height_locked.end(); ++it)
+      output.push_back(*it + origin);
 }
 
 ITrackSegmentPtr SplineTrack::merge_exit(PointI where, track::Direction dir)
@@ -360,10 +415,13 @@ float SplineTrack::rotation_at(float curve_delta) const
 }
 
 void SplineTrack::transform(const track::TravelToken& token,
-                            float delta, bool backwards) const
+                            float delta) const
 {
    assert(delta < curve.length);
 
+   // The token parameter is non-zero if travelling from exit to entry
+   const bool backwards = token.param != 0;
+
    const float curve_delta =
       (backwards ? curve.length - delta : delta) / curve.length;
 
@@ -385,8 +443,6 @@ void SplineTrack::transform(const track::TravelToken& token,
 track::TravelToken SplineTrack::get_travel_token(track::Position pos,
                                                  track::Direction dir) const
 {
-   using namespace placeholders;
-
    ensure_valid_direction(dir);
 
    const bool backwards = dir == -exit_dir;
@@ -394,8 +450,9 @@ track::TravelToken SplineTrack::get_travel_token(track::Position pos,
    track::TravelToken tok = {
       dir,
       pos,
-      bind(&SplineTrack::transform, this, _1, _2, backwards),
-      track::flat_gradient_func,
+      this,
+      &shape,
+      backwards ? 1 : 0,
       1
    };
    return tok;
@@ -416,5 +473,5 @@ ITrackSegmentPtr make_spline_track(VectorI delta,
                                    track::Direction entry_dir,
                                    track::Direction exit_dir)
 {
-   return ITrackSegmentPtr(new SplineTrack(delta, entry_dir, exit_dir));
+   return make_pooled<SplineTrack>(delta, entry_dir, exit_dir);
 }
@@ -18,6 +18,7 @@
 #include "ITrackSegment.hpp"
 #include "TrackCommon.hpp"
 #include "ILogger.hpp"
+#include "Pool.hpp"
 #include "XMLBuilder.hpp"
 #include "Matrix.hpp"
 #include "OpenGLHelper.hpp"
@@ -27,7 +28,6 @@
 
 #include <boost/lexical_cast.hpp>
 
-using namespace placeholders;
 using namespace boost;
 using namespace track;
 
@@ -47,6 +47,11 @@ public:
    float segment_length(const track::TravelToken& token) const { return 1.0f; }
 
    Connection next_position(const track::TravelToken& a_direction) const;
+   void get_exits(const track::TravelToken& a_token,
+                  vector<track::Connection>& exits) const
+   {
+      exits.push_back(next_position(a_token));
+   }
    bool is_valid_direction(const Direction& a_direction) const;
    void get_endpoints(PointList& a_list) const;
    void get_covers(PointList& output) const { }
@@ -71,6 +76,13 @@ private:
    Point<int> origin;  // Absolute position
    Direction direction;
    float height;
+
+   static const track::TrackShape shape;
+};
+
+const track::TrackShape StraightTrack::shape = {
+   track::transform_member<StraightTrack, &StraightTrack::transform>,
+   track::flat_gradient_func
 };
 
 StraightTrack::StraightTrack(const Direction& a_direction)
@@ -99,8 +111,9 @@ StraightTrack::get_travel_token(track::Position a_position,
    track::TravelToken tok = {
       a_direction,
       a_position,
-      bind(&StraightTrack::transform, this, _1, _2),
-      track::flat_gradient_func,
+      this,
+      &shape,
+      0,
       1
    };
    return tok;
@@ -259,5 +272,5 @@ ITrackSegmentPtr make_straight_track(const Direction& a_direction)
       throw runtime_error("Illegal straight track direction: "
          + lexical_cast<string>(a_direction));
 
-   return ITrackSegmentPtr(new StraightTrack(real_dir));
+   return make_pooled<StraightTrack>(real_dir);
 }
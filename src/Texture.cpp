@@ -17,8 +17,10 @@
 
 #include "ITexture.hpp"
 #include "ILogger.hpp"
+#include "IConfig.hpp"
+#include "Preload.hpp"
+#include "LRUCache.hpp"
 
-#include <map>
 #include <sstream>
 #include <stdexcept>
 
@@ -29,9 +31,12 @@
 
 class Texture : public ITexture {
 public:
-   Texture(const string &file);
+   // Takes ownership of the surface
+   Texture(const string &file, SDL_Surface* surface);
    ~Texture();
 
+   static SDL_Surface* decode(const string& file);
+
    GLuint texture() const { return my_texture; }
    void bind();
 
@@ -47,25 +52,73 @@ private:
       int width, int height, int ncols = 4, GLenum format = GL_RGBA);
 };
 
+// Drivers usually pad textures out to four bytes a pixel
+static size_t surface_size(SDL_Surface* const& surface)
+{
+   return size_t(surface->w) * surface->h * 4;
+}
+
 // Texture cache
+// The budget is set from the config before anything is added
 namespace {
-   map<string, ITexturePtr> the_texture_cache;
+   LRUCache<ITexture> the_texture_cache(0);
+
+   // Images decoded on the loader threads
+   // Textures are only ever created on the main thread
+   PrefetchTable<SDL_Surface*> the_prefetched_images(surface_size,
+                                                     SDL_FreeSurface);
 }
 
-ITexturePtr load_texture(const string& a_file_name)
+static size_t texture_budget()
 {
-   map<string, ITexturePtr>::iterator it =
-      the_texture_cache.find(a_file_name);
+   return size_t(get_config()->get<int>("TextureCacheMB")) * 1024 * 1024;
+}
+
+void set_texture_prefetch_budget()
+{
+   the_prefetched_images.set_budget(texture_budget());
+}
+
+void prefetch_texture(const string& a_file_name)
+{
+   the_prefetched_images.start(a_file_name,
+      bind(Texture::decode, a_file_name));
+}
 
-   if (it != the_texture_cache.end())
-      return (*it).second;
+ITexturePtr load_texture(const string& a_file_name)
+{
+   ITexturePtr cached = the_texture_cache.find(a_file_name);
+   if (cached)
+      return cached;
    else {
-      ITexturePtr ptr(new Texture(a_file_name));
-      the_texture_cache[a_file_name] = ptr;
+      SDL_Surface* surface;
+      if (!the_prefetched_images.take(a_file_name, surface))
+         surface = Texture::decode(a_file_name);
+
+      const size_t cost = surface_size(surface);
+      ITexturePtr ptr(new Texture(a_file_name, surface));
+
+      // Images decoded in the background but not used yet take their
+      // share of the budget
+      const size_t budget = texture_budget();
+      const size_t prefetched =
+         min(budget, the_prefetched_images.outstanding());
+      the_texture_cache.set_budget(budget - prefetched);
+      the_texture_cache.insert(a_file_name, ptr, cost);
+
+      debug() << "Texture cache using " << the_texture_cache.used() / 1024
+              << "KB for " << the_texture_cache.size() << " textures with "
+              << prefetched / 1024 << "KB prefetched";
+
       return ptr;
    }
 }
 
+void discard_prefetched_textures()
+{
+   the_prefetched_images.clear();
+}
+
 ITexturePtr load_texture(IResourcePtr a_res, const string& a_file_name)
 {
    // Hack alert! Just use the handle to find out the file name
@@ -80,7 +133,9 @@ ITexturePtr load_texture(IResourcePtr a_res, const string& a_file_name)
    return load_texture(real_file_name);
 }
 
-Texture::Texture(const string &file)
+// Read the image into memory without touching OpenGL so this can be
+// run on any thread
+SDL_Surface* Texture::decode(const string& file)
 {
    SDL_Surface *surface = IMG_Load(file.c_str());
    if (NULL == surface) {
@@ -89,6 +144,11 @@ Texture::Texture(const string &file)
       throw runtime_error(os.str());
    }
 
+   return surface;
+}
+
+Texture::Texture(const string &file, SDL_Surface* surface)
+{
    if (!is_power_of_two(surface->w))
       warn() << file << " width not a power of 2";
    if (!is_power_of_two(surface->h))
@@ -113,6 +173,8 @@ Texture::Texture(const string &file)
          texture_format = GL_BGR;
    }
    else {
+      SDL_FreeSurface(surface);
+
       ostringstream os;
       os << "Unsupported image colour format: " << file;
       throw runtime_error(os.str());
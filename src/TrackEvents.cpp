@@ -0,0 +1,292 @@
+//
+//  Copyright (C) 2011  Nick Gasson
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "ITrackEvents.hpp"
+
+#include <limits>
+#include <algorithm>
+#include <set>
+
+// Events are stored in a table with a slot for each direction of each
+// tile. Filling in one entry fills in every entry along the way so
+// each piece of track is only iterated over once
+class TrackEvents : public ITrackEvents, public ITrackListener {
+public:
+   TrackEvents(IMapPtr a_map);
+
+   // ITrackEvents interface
+   const TrackEvent& next_event(const track::Connection& entry);
+   TrackEvent following_event(const track::Connection& entry);
+
+   // ITrackListener interface
+   void track_changed(const PointList& tiles);
+
+private:
+   typedef track::Connection Connection;
+
+   int slot_index(const Connection& c) const;
+   const TrackEvent& fill(const Connection& entry);
+   void store(int slot, const TrackEvent& e);
+   void forget(int slot);
+   void add_predecessors(const Connection& c, vector<Connection>& work) const;
+
+   IMapPtr map;
+
+   // Index into events for each tile and direction or one of the
+   // special values below
+   vector<int> slots;
+   vector<TrackEvent> events;
+   vector<int> free_events;
+
+   enum { UNKNOWN = -1, ON_PATH = -2 };
+
+   // Returned for connections which are off the map
+   TrackEvent off_map;
+};
+
+namespace {
+
+   const track::Direction entry_dirs[] = {
+      axis::X, -axis::X, axis::Y, -axis::Y
+   };
+
+   const unsigned NEVER = numeric_limits<unsigned>::max();
+}
+
+TrackEvents::TrackEvents(IMapPtr a_map)
+   : map(a_map),
+     slots(a_map->width() * a_map->depth() * 4, UNKNOWN)
+{
+   off_map.status = TRACK_NO_MORE;
+   off_map.segments = 0;
+   off_map.distance = 0.0f;
+}
+
+int TrackEvents::slot_index(const Connection& c) const
+{
+   const track::Position& p = c.first;
+   if (p.x < 0 || p.y < 0 || p.x >= map->width() || p.y >= map->depth())
+      return -1;
+
+   for (int i = 0; i < 4; i++) {
+      if (c.second == entry_dirs[i])
+         return (p.x + p.y * map->width()) * 4 + i;
+   }
+
+   return -1;
+}
+
+const TrackEvent& TrackEvents::next_event(const Connection& entry)
+{
+   const int s = slot_index(entry);
+   if (s < 0)
+      return off_map;
+   else if (slots[s] >= 0)
+      return events[slots[s]];
+   else
+      return fill(entry);
+}
+
+TrackEvent TrackEvents::following_event(const Connection& entry)
+{
+   if (!map->is_valid_track(entry.first))
+      return off_map;
+
+   ITrackSegmentPtr track = map->track_at(entry.first);
+   if (!track->is_valid_direction(entry.second))
+      return off_map;
+
+   // The points may be changed at any time so follow their current
+   // state rather than remembering it
+   const track::TravelToken token =
+      track->get_travel_token(entry.first, entry.second);
+
+   TrackEvent e = next_event(track->next_position(token));
+   if (e.segments != NEVER) {
+      e.segments++;
+      e.distance += track->segment_length(token);
+   }
+   return e;
+}
+
+// Walk along the track until we find the next event or a connection
+// we already know about, then fill in the table on the way back
+const TrackEvent& TrackEvents::fill(const Connection& entry)
+{
+   vector<pair<int, float> > path;
+   TrackEvent end;
+
+   Connection c = entry;
+   for (;;) {
+      const int s = slot_index(c);
+      if (s < 0) {
+         end = off_map;
+         break;
+      }
+      else if (slots[s] >= 0) {
+         end = events[slots[s]];
+         break;
+      }
+      else if (slots[s] == ON_PATH) {
+         // Gone round in a circle without seeing anything
+         end.status = TRACK_OK;
+         end.segments = NEVER;
+         end.distance = numeric_limits<float>::infinity();
+         break;
+      }
+
+      if (map->is_valid_track(c.first)
+          && !map->track_at(c.first)->is_valid_direction(c.second)) {
+         // Running into the side of some track is as bad as running
+         // off the end
+         end = off_map;
+         store(s, end);
+         break;
+      }
+
+      const TrackIterator it = iterate_track(map, c.first, c.second);
+      if (it.status != TRACK_OK) {
+         end.status = it.status;
+         end.segments = 0;
+         end.distance = 0.0f;
+         end.track = it.track;
+         end.station = it.station;
+
+         store(s, end);
+         break;
+      }
+
+      slots[s] = ON_PATH;
+      path.push_back(make_pair(s, it.track->segment_length(it.token)));
+
+      c = it.track->next_position(it.token);
+   }
+
+   for (vector<pair<int, float> >::reverse_iterator it = path.rbegin();
+        it != path.rend(); ++it) {
+      if (end.segments != NEVER) {
+         end.segments++;
+         end.distance += (*it).second;
+      }
+
+      store((*it).first, end);
+   }
+
+   const int s = slot_index(entry);
+   return s < 0 ? off_map : events[slots[s]];
+}
+
+void TrackEvents::store(int slot, const TrackEvent& e)
+{
+   if (free_events.empty()) {
+      slots[slot] = events.size();
+      events.push_back(e);
+   }
+   else {
+      slots[slot] = free_events.back();
+      free_events.pop_back();
+      events[slots[slot]] = e;
+   }
+}
+
+void TrackEvents::forget(int slot)
+{
+   TrackEvent& e = events[slots[slot]];
+   e.track.reset();
+   e.station.reset();
+
+   free_events.push_back(slots[slot]);
+   slots[slot] = UNKNOWN;
+}
+
+// Find the connections which lead straight into this one
+void TrackEvents::add_predecessors(const Connection& c,
+                                   vector<Connection>& work) const
+{
+   const PointI behind = make_point(c.first.x - c.second.x,
+                                    c.first.y - c.second.z);
+   if (!map->is_valid_track(behind))
+      return;
+
+   ITrackSegmentPtr track = map->track_at(behind);
+
+   PointList ends;
+   track->get_endpoints(ends);
+
+   vector<Connection> exits;
+   for (PointList::const_iterator it = ends.begin(); it != ends.end(); ++it) {
+      for (int i = 0; i < 4; i++) {
+         const Connection p = make_pair(*it, entry_dirs[i]);
+         if (!track->is_valid_direction(p.second))
+            continue;
+
+         exits.clear();
+         track->get_exits(track->get_travel_token(p.first, p.second), exits);
+         if (find(exits.begin(), exits.end(), c) != exits.end())
+            work.push_back(p);
+      }
+   }
+}
+
+// Forget everything on the changed tiles and everything which was
+// found by looking through them. We can stop at anything we didn't
+// know already since whatever led there must be unknown too
+void TrackEvents::track_changed(const PointList& tiles)
+{
+   set<PointI> changed(tiles.begin(), tiles.end());
+
+   for (PointList::const_iterator it = tiles.begin();
+        it != tiles.end(); ++it) {
+      if (map->is_valid_track(*it)) {
+         PointList ends;
+         map->track_at(*it)->get_endpoints(ends);
+         changed.insert(ends.begin(), ends.end());
+      }
+   }
+
+   vector<Connection> work;
+   for (set<PointI>::const_iterator it = changed.begin();
+        it != changed.end(); ++it) {
+      for (int i = 0; i < 4; i++) {
+         const Connection c = make_pair(*it, entry_dirs[i]);
+         const int s = slot_index(c);
+         if (s >= 0 && slots[s] >= 0) {
+            forget(s);
+            add_predecessors(c, work);
+         }
+      }
+   }
+
+   while (!work.empty()) {
+      const Connection c = work.back();
+      work.pop_back();
+
+      // Events on the segment itself don't depend on what's beyond it
+      const int s = slot_index(c);
+      if (s >= 0 && slots[s] >= 0 && events[slots[s]].segments > 0) {
+         forget(s);
+         add_predecessors(c, work);
+      }
+   }
+}
+
+ITrackEventsPtr make_track_events(IMapPtr map)
+{
+   shared_ptr<TrackEvents> e(new TrackEvents(map));
+   map->add_track_listener(e);
+   return e;
+}
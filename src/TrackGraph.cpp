@@ -17,11 +17,19 @@
 
 #include "ITrackGraph.hpp"
 #include "ILogger.hpp"
-#include "IterateTrack.hpp"
 
 #include <stdexcept>
+#include <fstream>
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <set>
 
-class TrackGraph : public ITrackGraph {
+// The graph is built by walking from every entry to a station or
+// points until the next one is reached. Each walk remembers the tiles
+// it passed over so when the track changes only the walks through the
+// changed tiles need to be repeated
+class TrackGraph : public ITrackGraph, public ITrackListener {
 public:
    TrackGraph(IMapPtr map);
 
@@ -29,72 +37,520 @@ public:
    void write_dot_file(const string& file) const;
    const graph::Node& root() const;
    const graph::Node& node(unsigned n) const;
+   unsigned node_count() const { return nodes.size(); }
+   const graph::Arc* arcs_begin(unsigned n) const;
+   const graph::Arc* arcs_end(unsigned n) const;
+   bool find_node(const track::Connection& entry, unsigned& n) const;
+   unsigned revision() const { return my_revision; }
+
+   // ITrackListener interface
+   void track_changed(const PointList& tiles);
 
 private:
-   void walk_track(TrackIterator it,
-                   set<ITrackSegmentPtr>& visited,
-                   graph::Node& where);
-   graph::Node& add_node(graph::NodeType type);
-   
+   typedef track::Connection Connection;
+   typedef set<Connection> ConnectionSet;
+
+   struct Edge {
+      Connection end;
+      float length;
+      Connection exit;
+   };
+
+   struct Vertex {
+      graph::NodeType type;
+      ITrackSegmentPtr track;
+      IStationPtr station;
+      vector<Edge> edges;
+
+      // Every tile the outgoing edges pass over
+      PointList tiles;
+
+      unsigned id;
+   };
+
+   typedef map<Connection, Vertex> VertexMap;
+
+   void build();
+   bool is_feature(const PointI& p, ITrackSegmentPtr track,
+                   IStationPtr& station) const;
+   bool is_entry(ITrackSegmentPtr track, const Connection& c) const;
+   void add_feature(ITrackSegmentPtr track, IStationPtr station,
+                    ConnectionSet& pending);
+   void add_vertex(const Connection& c, graph::NodeType type,
+                   ITrackSegmentPtr track, IStationPtr station);
+   void remove_vertex(const Connection& c);
+   void forget_tiles(const Connection& c, Vertex& v);
+   void walk_vertex(const Connection& c, ConnectionSet& pending);
+   void walk_root(ConnectionSet& pending);
+   bool walk_edge(Vertex& from, Connection exit, float length,
+                  ConnectionSet& pending);
+   void walk_pending(ConnectionSet& pending);
+   void compile();
+
+   IMapPtr my_map;
+   VertexMap vertices;
+   Vertex root_vertex;
+   Connection root_entry;
+
+   // The vertices whose edges pass over each tile
+   map<PointI, ConnectionSet> tile_sources;
+
+   // No walk can be longer than this without going round in circles
+   unsigned segment_count;
+
+   // Compressed sparse row form of the graph: the arcs leaving node
+   // n are arcs[offsets[n]] to arcs[offsets[n + 1] - 1]
    vector<graph::Node> nodes;
+   vector<unsigned> offsets;
+   vector<graph::Arc> arcs;
+   unsigned my_revision;
 };
 
+namespace {
+
+   // Every direction a train can enter a tile
+   const track::Direction entry_dirs[] = {
+      axis::X, -axis::X, axis::Y, -axis::Y
+   };
+
+   // The connection a train leaves by if it turns round on entering
+   // a segment
+   track::Connection reverse(const track::Connection& c)
+   {
+      return make_pair(make_point(c.first.x - c.second.x,
+                                  c.first.y - c.second.z),
+                       -c.second);
+   }
+
+   const char* type_name(graph::NodeType type)
+   {
+      switch (type) {
+      case graph::NODE_ROOT: return "start";
+      case graph::NODE_STATION: return "station";
+      case graph::NODE_POINTS: return "points";
+      case graph::NODE_END: return "end";
+      default: return "?";
+      }
+   }
+}
+
 TrackGraph::TrackGraph(IMapPtr map)
+   : my_map(map), segment_count(0), my_revision(0)
 {
-   track::Position p;
-   track::Direction d;
-   tie(p, d) = map->start();
+   build();
+}
+
+// Build the whole graph from scratch
+void TrackGraph::build()
+{
+   vertices.clear();
+   tile_sources.clear();
+
+   ConnectionSet pending;
+   set<const ITrackSegment*> seen;
+
+   for (int x = 0; x < my_map->width(); x++) {
+      for (int y = 0; y < my_map->depth(); y++) {
+         const PointI p = make_point(x, y);
+         if (!my_map->is_valid_track(p))
+            continue;
+
+         ITrackSegmentPtr track = my_map->track_at(p);
+         if (!seen.insert(track.get()).second)
+            continue;
+
+         IStationPtr station;
+         if (is_feature(p, track, station))
+            add_feature(track, station, pending);
+      }
+   }
+
+   segment_count = seen.size();
 
-   graph::Node& root = add_node(graph::NODE_ROOT);
+   walk_root(pending);
+   walk_pending(pending);
+   compile();
 
-   set<ITrackSegmentPtr> visited;
-   walk_track(iterate_track(map, p, d), visited, root);
+   debug() << "Track graph has " << nodes.size() << " nodes and "
+           << arcs.size() << " arcs";
 }
 
-void TrackGraph::walk_track(TrackIterator it,
-                            set<ITrackSegmentPtr>& visited,
-                            graph::Node& where)
+// Points and stations become nodes: everything else is folded into arcs
+bool TrackGraph::is_feature(const PointI& p, ITrackSegmentPtr track,
+                            IStationPtr& station) const
 {
-   if (visited.find(it.track) != visited.end()) {
-      // TODO: connect up with arc         
+   station = my_map->station_on_track(p);
+   return track->has_multiple_states() || station;
+}
+
+// True if a train can properly enter the track at this connection:
+// i.e. it could come back the way it came from every exit
+bool TrackGraph::is_entry(ITrackSegmentPtr track, const Connection& c) const
+{
+   if (!track->is_valid_direction(c.second))
+      return false;
+
+   vector<Connection> exits;
+   track->get_exits(track->get_travel_token(c.first, c.second), exits);
+
+   const Connection back = reverse(c);
+
+   for (vector<Connection>::const_iterator it = exits.begin();
+        it != exits.end(); ++it) {
+      const Connection rev = reverse(*it);
+      if (!track->is_valid_direction(rev.second))
+         return false;
+
+      vector<Connection> rev_exits;
+      track->get_exits(track->get_travel_token(rev.first, rev.second),
+                       rev_exits);
+
+      if (find(rev_exits.begin(), rev_exits.end(), back) == rev_exits.end())
+         return false;
    }
 
-   visited.insert(it.track);
+   return !exits.empty();
+}
+
+// Add a vertex for every way into a station or set of points
+void TrackGraph::add_feature(ITrackSegmentPtr track, IStationPtr station,
+                             ConnectionSet& pending)
+{
+   const graph::NodeType type = track->has_multiple_states()
+      ? graph::NODE_POINTS : graph::NODE_STATION;
 
-   switch (it.status) {
-   case TRACK_STATION:
-      // TODO
-   case TRACK_OK:
-      walk_track(it.next(), visited, where);
-      break;
+   PointList ends;
+   track->get_endpoints(ends);
 
-   case TRACK_NO_MORE:
-      break;
+   for (PointList::const_iterator it = ends.begin();
+        it != ends.end(); ++it) {
+      for (int i = 0; i < 4; i++) {
+         const Connection c = make_pair(*it, entry_dirs[i]);
+         if (vertices.find(c) == vertices.end() && is_entry(track, c)) {
+            add_vertex(c, type, track, station);
+            pending.insert(c);
+         }
+      }
+   }
+}
 
-   case TRACK_CHOICE:
-      throw runtime_error("can't graph track with choice yet!");
-      
+void TrackGraph::add_vertex(const Connection& c, graph::NodeType type,
+                            ITrackSegmentPtr track, IStationPtr station)
+{
+   Vertex& v = vertices[c];
+   v.type = type;
+   v.track = track;
+   v.station = station;
+   v.id = 0;
+}
+
+void TrackGraph::remove_vertex(const Connection& c)
+{
+   VertexMap::iterator it = vertices.find(c);
+   if (it != vertices.end()) {
+      forget_tiles(c, (*it).second);
+      vertices.erase(it);
    }
 }
 
-graph::Node& TrackGraph::add_node(graph::NodeType type)
+// Remove the record of an edge walk starting at this vertex
+void TrackGraph::forget_tiles(const Connection& c, Vertex& v)
+{
+   for (PointList::const_iterator it = v.tiles.begin();
+        it != v.tiles.end(); ++it) {
+      map<PointI, ConnectionSet>::iterator s = tile_sources.find(*it);
+      if (s != tile_sources.end()) {
+         (*s).second.erase(c);
+         if ((*s).second.empty())
+            tile_sources.erase(s);
+      }
+   }
+
+   v.tiles.clear();
+   v.edges.clear();
+}
+
+// Follow the track out of every exit of a vertex
+void TrackGraph::walk_vertex(const Connection& c, ConnectionSet& pending)
+{
+   VertexMap::iterator it = vertices.find(c);
+   if (it == vertices.end() || (*it).second.type == graph::NODE_END)
+      return;
+
+   Vertex& v = (*it).second;
+   forget_tiles(c, v);
+
+   const track::TravelToken token =
+      v.track->get_travel_token(c.first, c.second);
+   const float length = v.track->segment_length(token);
+
+   vector<Connection> exits;
+   v.track->get_exits(token, exits);
+
+   for (vector<Connection>::const_iterator e = exits.begin();
+        e != exits.end(); ++e)
+      walk_edge(v, *e, length, pending);
+
+   for (PointList::const_iterator t = v.tiles.begin();
+        t != v.tiles.end(); ++t)
+      tile_sources[*t].insert(c);
+}
+
+// The root has a single edge to the first feature after the start
+// location which may have zero length
+void TrackGraph::walk_root(ConnectionSet& pending)
 {
-   unsigned id = nodes.size();
-   graph::Node n = { id, type };
-   nodes.push_back(n);
-   return nodes.at(id);
+   root_entry = my_map->start();
+
+   root_vertex.type = graph::NODE_ROOT;
+   root_vertex.track.reset();
+   root_vertex.station.reset();
+   root_vertex.tiles.clear();
+   root_vertex.edges.clear();
+
+   if (my_map->is_valid_track(root_entry.first))
+      root_vertex.track = my_map->track_at(root_entry.first);
+
+   walk_edge(root_vertex, root_entry, 0.0f, pending);
 }
-   
+
+// Follow plain track from an exit until it reaches another vertex
+bool TrackGraph::walk_edge(Vertex& from, Connection exit, float length,
+                           ConnectionSet& pending)
+{
+   Edge edge = { exit, length, exit };
+
+   for (unsigned steps = 0; steps <= segment_count; steps++) {
+      const track::Position& pos = edge.end.first;
+      const track::Direction& dir = edge.end.second;
+
+      from.tiles.push_back(pos);
+
+      if (vertices.find(edge.end) != vertices.end()) {
+         from.edges.push_back(edge);
+         return true;
+      }
+
+      ITrackSegmentPtr track;
+      if (my_map->is_valid_track(pos))
+         track = my_map->track_at(pos);
+
+      if (!track || !track->is_valid_direction(dir)) {
+         add_vertex(edge.end, graph::NODE_END,
+                    ITrackSegmentPtr(), IStationPtr());
+         from.edges.push_back(edge);
+         return true;
+      }
+
+      IStationPtr station;
+      if (is_feature(pos, track, station)) {
+         // Running into the side of a set of points is as good as
+         // running off the end of the track
+         if (is_entry(track, edge.end)) {
+            add_vertex(edge.end, track->has_multiple_states()
+                       ? graph::NODE_POINTS : graph::NODE_STATION,
+                       track, station);
+            pending.insert(edge.end);
+         }
+         else
+            add_vertex(edge.end, graph::NODE_END,
+                       ITrackSegmentPtr(), IStationPtr());
+
+         from.edges.push_back(edge);
+         return true;
+      }
+
+      const track::TravelToken token = track->get_travel_token(pos, dir);
+      edge.length += track->segment_length(token);
+      edge.end = track->next_position(token);
+   }
+
+   // A loop of plain track with nothing on it
+   return false;
+}
+
+void TrackGraph::walk_pending(ConnectionSet& pending)
+{
+   while (!pending.empty()) {
+      const Connection c = *pending.begin();
+      pending.erase(pending.begin());
+
+      walk_vertex(c, pending);
+   }
+}
+
+// Number the vertices and pack the edges into arrays
+void TrackGraph::compile()
+{
+   // Drop dead ends nothing leads to any more
+   set<Connection> referenced;
+   for (VertexMap::const_iterator it = vertices.begin();
+        it != vertices.end(); ++it) {
+      for (vector<Edge>::const_iterator e = (*it).second.edges.begin();
+           e != (*it).second.edges.end(); ++e)
+         referenced.insert((*e).end);
+   }
+
+   for (vector<Edge>::const_iterator e = root_vertex.edges.begin();
+        e != root_vertex.edges.end(); ++e)
+      referenced.insert((*e).end);
+
+   VertexMap::iterator it = vertices.begin();
+   while (it != vertices.end()) {
+      if ((*it).second.type == graph::NODE_END
+          && referenced.find((*it).first) == referenced.end())
+         vertices.erase(it++);
+      else
+         ++it;
+   }
+
+   nodes.clear();
+   offsets.clear();
+   arcs.clear();
+
+   graph::Node root = {
+      0, graph::NODE_ROOT, root_vertex.track, root_entry, IStationPtr()
+   };
+   nodes.push_back(root);
+
+   unsigned id = 1;
+   for (it = vertices.begin(); it != vertices.end(); ++it) {
+      Vertex& v = (*it).second;
+      v.id = id++;
+
+      graph::Node n = { v.id, v.type, v.track, (*it).first, v.station };
+      nodes.push_back(n);
+   }
+
+   offsets.reserve(nodes.size() + 1);
+
+   const Vertex* from = &root_vertex;
+   it = vertices.begin();
+   for (unsigned n = 0; n < nodes.size(); n++) {
+      offsets.push_back(arcs.size());
+
+      for (vector<Edge>::const_iterator e = from->edges.begin();
+           e != from->edges.end(); ++e) {
+         VertexMap::const_iterator to = vertices.find((*e).end);
+         assert(to != vertices.end());
+
+         graph::Arc arc = { n, (*to).second.id, (*e).length, (*e).exit };
+         arcs.push_back(arc);
+      }
+
+      if (it != vertices.end())
+         from = &(*it++).second;
+   }
+
+   offsets.push_back(arcs.size());
+
+   my_revision++;
+}
+
+// Repeat every walk which passed over the changed tiles
+void TrackGraph::track_changed(const PointList& tiles)
+{
+   // A change on one tile can affect the whole of a segment - e.g.
+   // adding a station to one end of a curve
+   set<PointI> changed(tiles.begin(), tiles.end());
+   set<const ITrackSegment*> seen;
+   vector<pair<PointI, ITrackSegmentPtr> > tracks;
+
+   for (PointList::const_iterator it = tiles.begin();
+        it != tiles.end(); ++it) {
+      if (!my_map->is_valid_track(*it))
+         continue;
+
+      ITrackSegmentPtr track = my_map->track_at(*it);
+      if (seen.insert(track.get()).second) {
+         tracks.push_back(make_pair(*it, track));
+
+         PointList ends;
+         track->get_endpoints(ends);
+         changed.insert(ends.begin(), ends.end());
+      }
+   }
+
+   ConnectionSet pending;
+   bool root_dirty = false;
+
+   for (set<PointI>::const_iterator it = changed.begin();
+        it != changed.end(); ++it) {
+      map<PointI, ConnectionSet>::const_iterator s = tile_sources.find(*it);
+      if (s != tile_sources.end())
+         pending.insert((*s).second.begin(), (*s).second.end());
+
+      for (int i = 0; i < 4; i++) {
+         const Connection c = make_pair(*it, entry_dirs[i]);
+         remove_vertex(c);
+         pending.erase(c);
+      }
+   }
+
+   for (PointList::const_iterator it = root_vertex.tiles.begin();
+        it != root_vertex.tiles.end() && !root_dirty; ++it)
+      root_dirty = changed.find(*it) != changed.end();
+
+   if (my_map->start() != root_entry)
+      root_dirty = true;
+
+   for (vector<pair<PointI, ITrackSegmentPtr> >::const_iterator it =
+           tracks.begin(); it != tracks.end(); ++it) {
+      IStationPtr station;
+      if (is_feature((*it).first, (*it).second, station))
+         add_feature((*it).second, station, pending);
+   }
+
+   // The number of segments only matters as a bound on the walk so
+   // it's fine to over-estimate it
+   segment_count += tracks.size();
+
+   if (root_dirty)
+      walk_root(pending);
+   walk_pending(pending);
+
+   // Walks which ended at a removed vertex were in the pending set so
+   // every edge should now lead somewhere
+   compile();
+}
+
 const graph::Node& TrackGraph::root() const
 {
    assert(nodes.size() > 0);
-   return nodes.at(0);
+   return nodes.front();
 }
 
 const graph::Node& TrackGraph::node(unsigned n) const
 {
    assert(n < nodes.size());
-   return nodes.at(n);
+   return nodes[n];
+}
+
+const graph::Arc* TrackGraph::arcs_begin(unsigned n) const
+{
+   assert(n < nodes.size());
+   return arcs.empty() ? NULL : &arcs[0] + offsets[n];
+}
+
+const graph::Arc* TrackGraph::arcs_end(unsigned n) const
+{
+   assert(n < nodes.size());
+   return arcs.empty() ? NULL : &arcs[0] + offsets[n + 1];
+}
+
+bool TrackGraph::find_node(const track::Connection& entry, unsigned& n) const
+{
+   VertexMap::const_iterator it = vertices.find(entry);
+   if (it != vertices.end()) {
+      n = (*it).second.id;
+      return true;
+   }
+   else if (entry == root_entry) {
+      n = 0;
+      return true;
+   }
+   else
+      return false;
 }
 
 void TrackGraph::write_dot_file(const string& file) const
@@ -103,10 +559,35 @@ void TrackGraph::write_dot_file(const string& file) const
    if (!of.good())
       throw runtime_error("failed to open " + file);
 
+   of << "digraph track {" << endl;
+
+   for (vector<graph::Node>::const_iterator it = nodes.begin();
+        it != nodes.end(); ++it) {
+      of << "  n" << (*it).id << " [label=\"" << type_name((*it).type)
+         << "\\n" << (*it).entry.first.x << "," << (*it).entry.first.y
+         << "\"";
+
+      if ((*it).type == graph::NODE_ROOT)
+         of << ", shape=box";
+      else if ((*it).type == graph::NODE_END)
+         of << ", shape=point";
+
+      of << "];" << endl;
+   }
+
+   for (vector<graph::Arc>::const_iterator it = arcs.begin();
+        it != arcs.end(); ++it)
+      of << "  n" << (*it).start << " -> n" << (*it).end
+         << " [label=\"" << (*it).length << "\"];" << endl;
+
+   of << "}" << endl;
+
    log() << "Wrote track graph to " << file;
 }
 
 ITrackGraphPtr make_track_graph(IMapPtr map)
 {
-   return ITrackGraphPtr(new TrackGraph(map));
+   shared_ptr<TrackGraph> g(new TrackGraph(map));
+   map->add_track_listener(g);
+   return g;
 }
@@ -20,6 +20,7 @@
 #include "ILogger.hpp"
 #include "TrackCommon.hpp"
 #include "ISmokeTrail.hpp"
+#include "Consist.hpp"
 #include "OpenGLHelper.hpp"
 
 #include <stdexcept>
@@ -32,7 +33,8 @@
 // Concrete implementation of trains
 class Train : public ITrain {
 public:
-   Train(IMapPtr a_map);
+   Train(IMapPtr a_map, bool headless);
+   ~Train();
 
    // ITrain interface
    void render() const;
@@ -47,12 +49,16 @@ public:
 private:
    // The different parts of the train are on different track segments
    struct Part : boost::equality_comparable<Part> {
-      explicit Part(IRollingStockPtr a_vehicle)
-         : vehicle(a_vehicle), segment_delta(0.0), movement_sign(1.0)
+      Part(IRollingStockPtr a_vehicle, size_t an_index)
+         : vehicle(a_vehicle), index(an_index), segment_delta(0.0),
+           segment_length(0.0), sloped(false), movement_sign(1.0)
       {}
 
       IRollingStockPtr vehicle;
 
+      // Position of this part in the consist
+      size_t index;
+
       // The length of a track segment can be found by calling
       // segment_length() This delta value ranges from 0 to that length and
       // indicates how far along the segment the train is
@@ -60,6 +66,15 @@ private:
       float segment_delta;
       track::TravelToken travel_token;
 
+      // Cached result of segment_length() for the current travel token
+      float segment_length;
+
+      // Block of the segment this part is on which the train holds
+      TrackBlockPtr block;
+
+      // True if the gradient must be looked up as the part moves
+      bool sloped;
+
       // Direction train part is travelling along the track
       Vector<int> direction;
 
@@ -73,6 +88,16 @@ private:
    };
    list<Part> parts;
 
+   // Mass and gradient of each part in the same order as `parts'
+   Consist consist;
+
+   // Number of parts on sloped track: the gradients of the others are
+   // zero and don't need updating
+   unsigned sloped_parts;
+
+   // Vehicles which need update() calling each frame
+   vector<IRollingStockPtr> powered;
+
    const Part& engine() const;
    Part& engine();
    void move(double a_distance);
@@ -80,11 +105,22 @@ private:
    VectorF part_position(const Part& a_part) const;
    void update_smoke_position(int a_delta);
    void move_part(Part& part, double distance);
+   void add_to_consist(IRollingStockPtr a_vehicle);
+   static float part_gradient(const Part& part);
 
    static track::Connection reverse_token(const track::TravelToken& token);
    static void transform_to_part(const Part& p);
 
+   void occupy(Part& a_part, TrackBlockPtr a_block);
+   void leave(const Part& a_part, TrackBlockPtr a_block);
+   void release_blocks();
+
    IMapPtr map;
+
+   // Marks the blocks this train holds
+   const unsigned number;
+
+   // Null if this train is never rendered
    ISmokeTrailPtr smoke_trail;
 
    VectorF velocity_vector;
@@ -98,33 +134,106 @@ private:
 
 const double Train::SEPARATION(0.15);
 
-Train::Train(IMapPtr a_map)
-   : map(a_map), velocity_vector(make_vector(0.0f, 0.0f, 0.0f))
+namespace {
+   atomic<unsigned> next_train_number(1);
+}
+
+Train::Train(IMapPtr a_map, bool headless)
+   : sloped_parts(0), map(a_map), number(next_train_number++),
+     velocity_vector(make_vector(0.0f, 0.0f, 0.0f))
 {
-   parts.push_front(Part(load_engine("tank")));
+   try {
+      parts.push_front(Part(load_engine("tank"), 0));
+      add_to_consist(engine().vehicle);
 
-   enter_segment(engine(), a_map->start());
+      enter_segment(engine(), a_map->start());
 
-   // Bit of a hack to put the engine in the right place
-   move(0.275);
+      // Bit of a hack to put the engine in the right place
+      move(0.275);
 
 #if 1
-   for (int i = 1; i <= 4; i++)
-      add_part(load_waggon("coal_truck"));
+      for (int i = 1; i <= 4; i++)
+         add_part(load_waggon("coal_truck"));
 #endif
+   }
+   catch (...) {
+      // Another train may be in the way
+      release_blocks();
+      throw;
+   }
+
+   if (!headless)
+      smoke_trail = make_smoke_trail();
+}
 
-   smoke_trail = make_smoke_trail();
+Train::~Train()
+{
+   release_blocks();
 }
 
 void Train::add_part(IRollingStockPtr a_vehicle)
 {
-   Part part(a_vehicle);
+   Part part(a_vehicle, parts.size());
    enter_segment(part, map->start());
 
    // Push the rest of the train along some
-   move(part.vehicle->length() + SEPARATION);
+   try {
+      move(part.vehicle->length() + SEPARATION);
+   }
+   catch (...) {
+      leave(part, part.block);
+      throw;
+   }
 
    parts.push_back(part);
+   add_to_consist(a_vehicle);
+}
+
+// Take the block a part has just run onto and give up the one it left
+// if no other part is still on it
+// Running into a block another train holds is a crash
+void Train::occupy(Part& a_part, TrackBlockPtr a_block)
+{
+   if (a_block == a_part.block)
+      return;
+
+   if (!a_block->reserve(number))
+      throw runtime_error("Train ran into another train!");
+
+   TrackBlockPtr old = a_part.block;
+   a_part.block = a_block;
+
+   if (old)
+      leave(a_part, old);
+}
+
+// Release a block unless another part of the train is on it
+void Train::leave(const Part& a_part, TrackBlockPtr a_block)
+{
+   for (list<Part>::const_iterator it = parts.begin();
+        it != parts.end(); ++it) {
+      if (&*it != &a_part && (*it).block == a_block)
+         return;
+   }
+
+   a_block->release(number);
+}
+
+void Train::release_blocks()
+{
+   for (list<Part>::iterator it = parts.begin();
+        it != parts.end(); ++it) {
+      if ((*it).block)
+         (*it).block->release(number);
+   }
+}
+
+void Train::add_to_consist(IRollingStockPtr a_vehicle)
+{
+   consist.add(a_vehicle->mass());
+
+   if (a_vehicle->powered())
+      powered.push_back(a_vehicle);
 }
 
 Train::Part& Train::engine()
@@ -141,34 +250,41 @@ const Train::Part& Train::engine() const
 
 void Train::move_part(Part& part, double distance)
 {
-   // Never move in units greater than 1.0
+   // Consume whole segments at a time: each iteration either finishes
+   // the move inside the current segment or crosses exactly one boundary
    double d = abs(distance);
-   double sign = (distance >= 0.0 ? 1.0 : -1.0) * part.movement_sign;
-   const double step = 0.25;
+   const double dir = distance >= 0.0 ? 1.0 : -1.0;
 
-   //debug() << "move d=" << distance << " s=" << sign
-   //        << " ms=" << part.movement_sign;
+   //debug() << "move d=" << distance << " ms=" << part.movement_sign;
 
-   do {
-      part.segment_delta += min(step, d) * sign;
+   for (;;) {
+      const double sign = dir * part.movement_sign;
+
+      if (sign > 0.0) {
+         const double room = part.segment_length - part.segment_delta;
+         if (d < room) {
+            part.segment_delta += d;
+            break;
+         }
 
-      const double segment_length =
-         part.segment->segment_length(part.travel_token);
-      if (part.segment_delta >= segment_length) {
          // Moved onto a new piece of track
-         const double over = part.segment_delta - segment_length;
+         d -= room;
          enter_segment(part, part.segment->next_position(part.travel_token));
-         part.segment_delta = over;
       }
-      else if (part.segment_delta < 0.0) {
+      else {
+         if (d <= part.segment_delta) {
+            part.segment_delta -= d;
+            break;
+         }
+
+         // Backed off the start of the segment: enter the previous one
+         // travelling the other way round
+         d -= part.segment_delta;
          track::Connection prev = reverse_token(part.travel_token);
          enter_segment(part, prev);
-         part.segment_delta *= -1.0;
          part.movement_sign *= -1.0;
       }
-
-      d -= step;
-   } while (d > 0.0);
+   }
 }
 
 // Move the train along the line a bit
@@ -213,41 +329,57 @@ void Train::update_smoke_position(int a_delta)
    smoke_trail->set_delay(base_delay - (throttle * 15));
 }
 
-void Train::update(int delta)
+// Gradient under a part in its direction of travel
+float Train::part_gradient(const Part& part)
 {
-   double gravity_sum = 0.0;
-   for (list<Part>::iterator it = parts.begin();
-        it != parts.end(); ++it) {
-      float gradient = (*it).travel_token.gradient((*it).segment_delta);
+   float gradient = part.travel_token.gradient(part.segment_delta);
 
-      if ((*it).direction.x < 0 || (*it).direction.z < 0)
-         gradient *= -1.0f;
+   if (part.direction.x < 0 || part.direction.z < 0)
+      gradient *= -1.0f;
 
-      gradient *= (*it).movement_sign;
+   return gradient * part.movement_sign;
+}
 
-      const double g = 9.78;
-      gravity_sum += -g * gradient * (*it).vehicle->mass();
+void Train::update(int delta)
+{
+   // Most track is flat so usually there's nothing to look up
+   if (sloped_parts > 0) {
+      for (list<Part>::const_iterator it = parts.begin();
+           it != parts.end(); ++it) {
+         if ((*it).sloped)
+            consist.set_gradient((*it).index, part_gradient(*it));
+      }
    }
 
-   for (list<Part>::iterator it = parts.begin();
-        it != parts.end(); ++it)
-      (*it).vehicle->update(delta, gravity_sum);
+   const double gravity_sum = consist.gravity();
 
-   update_smoke_position(delta);
+   for (vector<IRollingStockPtr>::iterator it = powered.begin();
+        it != powered.end(); ++it)
+      (*it)->update(delta, gravity_sum);
 
    // How many metres does a tile correspond to?
    const double M_PER_UNIT = 5.0;
 
-   const VectorF old_pos = part_position(engine());
-
    const double delta_seconds = static_cast<float>(delta) / 1000.0f;
-   move(engine().vehicle->speed() * delta_seconds / M_PER_UNIT);
+   const double distance =
+      engine().vehicle->speed() * delta_seconds / M_PER_UNIT;
+
+   if (smoke_trail) {
+      update_smoke_position(delta);
 
-   velocity_vector = part_position(engine()) - old_pos;
+      const VectorF old_pos = part_position(engine());
+      move(distance);
+      velocity_vector = part_position(engine()) - old_pos;
+   }
+   else {
+      // The position is only needed to animate the smoke and that
+      // requires an OpenGL context
+      move(distance);
+   }
 }
 
 // Called when the train enters a new segment
-// Resets the delta and gets the length of the new segment
+// Resets the delta and caches the length of the new segment
 void Train::enter_segment(Part& a_part, const track::Connection& a_connection)
 {
    PointI pos;
@@ -264,6 +396,24 @@ void Train::enter_segment(Part& a_part, const track::Connection& a_connection)
    a_part.segment_delta = 0.0;
    a_part.segment = map->track_at(pos);
    a_part.travel_token = a_part.segment->get_travel_token(pos, a_part.direction);
+   a_part.segment_length = a_part.segment->segment_length(a_part.travel_token);
+
+   occupy(a_part, map->track_block(pos));
+
+   const bool sloped =
+      a_part.travel_token.shape->gradient != track::flat_gradient_func;
+
+   if (sloped != a_part.sloped) {
+      if (sloped)
+         sloped_parts++;
+      else
+         sloped_parts--;
+      a_part.sloped = sloped;
+   }
+
+   // Parts are entered before they're added to the consist
+   if (!sloped && a_part.index < consist.size())
+      consist.set_gradient(a_part.index, 0.0);
 }
 
 void Train::transform_to_part(const Part& p)
@@ -289,7 +439,8 @@ void Train::render() const
       glPopMatrix();
    }
 
-   smoke_trail->render();
+   if (smoke_trail)
+      smoke_trail->render();
 }
 
 ITrackSegmentPtr Train::track_segment() const
@@ -340,5 +491,11 @@ track::Connection Train::reverse_token(const track::TravelToken& token)
 // Make an empty train
 ITrainPtr make_train(IMapPtr a_map)
 {
-   return ITrainPtr(new Train(a_map));
+   return ITrainPtr(new Train(a_map, false));
+}
+
+// Make a train which can be updated without an OpenGL context
+ITrainPtr make_headless_train(IMapPtr a_map)
+{
+   return ITrainPtr(new Train(a_map, true));
 }
@@ -21,6 +21,7 @@
 #include "IResource.hpp"
 #include "IXMLParser.hpp"
 #include "ResourceCache.hpp"
+#include "Preload.hpp"
 #include "ILogger.hpp"
 #include "XMLBuilder.hpp"
 #include "Random.hpp"
@@ -168,3 +169,9 @@ ISceneryPtr load_tree(const AttributeSet& attrs)
 
    return ISceneryPtr(tree);
 }
+
+void prefetch_tree(IResourcePtr a_res)
+{
+   prefetch_resource_model(a_res, 1.0f, make_vector(0.0f, 0.0f, 0.0f),
+                           true);
+}
@@ -21,6 +21,7 @@
 #include "IXMLParser.hpp"
 #include "ILogger.hpp"
 #include "ResourceCache.hpp"
+#include "Preload.hpp"
 
 #include <stdexcept>
 
@@ -34,6 +35,7 @@ public:
 
    // IRollingStock interface
    void update(int delta, double gravity);
+   bool powered() const { return false; }
    void render() const;
    IControllerPtr controller();
    double speed() const { return 0.0; }
@@ -43,11 +45,11 @@ public:
 
    // IXMLCallback interface
    void text(const string& local_name, const string& a_string);
+
+   static const float MODEL_SCALE;
 private:
    IModelPtr model;
    IResourcePtr resource;
-
-   static const float MODEL_SCALE;
 };
 
 const float Waggon::MODEL_SCALE(0.4f);
@@ -103,3 +105,9 @@ IRollingStockPtr load_waggon(const string& a_res_id)
    return cache.load_copy(a_res_id);
 }
 
+void prefetch_waggon(IResourcePtr a_res)
+{
+   prefetch_resource_model(a_res, Waggon::MODEL_SCALE,
+                           make_vector(0.0f, 0.0f, 0.0f));
+}
+
@@ -19,63 +19,115 @@
 #include "ILogger.hpp"
 
 #include <stdexcept>
-#include <sstream>
 
 #include <xercesc/sax2/DefaultHandler.hpp>
 #include <xercesc/sax2/XMLReaderFactory.hpp>
 #include <xercesc/sax2/SAX2XMLReader.hpp>
 #include <xercesc/util/XMLString.hpp>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/internal/XMLGrammarPoolImpl.hpp>
+
+#include <map>
+#include <vector>
 
 using namespace xercesc;
 
+namespace {
+
+   // Append UTF-16 from the parser to a UTF-8 string
+   void append_utf8(string& out, const XMLCh* buf, XMLSize_t length)
+   {
+      for (XMLSize_t i = 0; i < length; i++) {
+         unsigned c = buf[i];
+
+         if (c < 0x80) {
+            out += static_cast<char>(c);
+            continue;
+         }
+
+         // Combine surrogate pairs
+         if (c >= 0xD800 && c < 0xDC00 && i + 1 < length
+             && buf[i + 1] >= 0xDC00 && buf[i + 1] < 0xE000)
+            c = 0x10000 + ((c - 0xD800) << 10) + (buf[++i] - 0xDC00);
+
+         if (c < 0x800)
+            out += static_cast<char>(0xC0 | (c >> 6));
+         else if (c < 0x10000) {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+         }
+         else {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+         }
+         out += static_cast<char>(0x80 | (c & 0x3F));
+      }
+   }
+
+   void assign_utf8(string& out, const XMLCh* str)
+   {
+      out.clear();
+      append_utf8(out, str, XMLString::stringLen(str));
+   }
+}
+
 // SAX2 handler to call our own methods
+// The strings are kept between calls so once they have grown large
+// enough parsing doesn't allocate for names or text
 struct SAX2WrapperHandler : public DefaultHandler {
    
    SAX2WrapperHandler() : callback_ptr(NULL) {}
+
+   void reset()
+   {
+      collecting.clear();
+      text_buf.clear();
+   }
    
    void startElement(const XMLCh* const uri,
                      const XMLCh* const localname,
                      const XMLCh* const qname,
                      const Attributes& attrs)
    {
-      char* ch_localname = XMLString::transcode(localname);
+      assign_utf8(name_buf, localname);
 
-      callback_ptr->start_element(ch_localname, AttributeSet(attrs));
-      
-      XMLString::release(&ch_localname);
+      callback_ptr->start_element(name_buf, AttributeSet(attrs, attr_buf));
+
+      collecting.push_back(callback_ptr->wants_text(name_buf));
+      text_buf.clear();
    }
 
    void characters(const XMLCh* const buf, const XMLSize_t length)
    {
-      char* ch_buf = XMLString::transcode(buf);
-
-      char_buf << ch_buf;
-
-      XMLString::release(&ch_buf);
+      if (!collecting.empty() && collecting.back())
+         append_utf8(text_buf, buf, length);
    }
 
    void endElement(const XMLCh* const uri,
                    const XMLCh* const localname,
                    const XMLCh* const qname)
    {
-      char* ch_localname = XMLString::transcode(localname);
+      assign_utf8(name_buf, localname);
 
-      if (char_buf.str().size() > 0) {
-         callback_ptr->text(ch_localname, char_buf.str());
-         char_buf.str("");
+      if (!text_buf.empty()) {
+         callback_ptr->text(name_buf, text_buf);
+         text_buf.clear();
       }
 
-      callback_ptr->end_element(ch_localname);
-      
-      XMLString::release(&ch_localname);
+      callback_ptr->end_element(name_buf);
+
+      collecting.pop_back();
    }
    
    void error(const SAXParseException& e) { throw e; }
    void fatalError(const SAXParseException& e) { throw e; }
 
    IXMLCallback* callback_ptr;
-   ostringstream char_buf;
+   string name_buf, text_buf, attr_buf;
+
+   // Whether the callback wants the text of each open element
+   vector<bool> collecting;
 };
 
 // Concrete XML parser using Xerces
@@ -90,11 +142,31 @@ private:
    SAX2WrapperHandler* my_handler;
 
    static int our_parser_count;
+
+   // Parsers for the same schema share the grammar loaded by the
+   // first rather than each reading and checking it again
+   // The schemas have no target namespace so there must be a separate
+   // pool for each one
+   typedef map<string, XMLGrammarPool*> GrammarPoolMap;
+   static GrammarPoolMap our_grammar_pools;
+
+   static void delete_grammar_pools();
 };
 
 // Number of parsers in use
 int XercesXMLParser::our_parser_count(0);
 
+XercesXMLParser::GrammarPoolMap XercesXMLParser::our_grammar_pools;
+
+void XercesXMLParser::delete_grammar_pools()
+{
+   for (GrammarPoolMap::iterator it = our_grammar_pools.begin();
+        it != our_grammar_pools.end(); ++it)
+      delete (*it).second;
+
+   our_grammar_pools.clear();
+}
+
 XercesXMLParser::XercesXMLParser(const string& a_schema_file)
 {
    log() << "Creating parser for XML schema " << a_schema_file;
@@ -114,10 +186,20 @@ XercesXMLParser::XercesXMLParser(const string& a_schema_file)
       
       atexit(XMLPlatformUtils::Terminate);
 
+      // Must be deleted before Xerces is terminated
+      atexit(delete_grammar_pools);
+
       log() << "Xerces initialised";
    }   
 
-   my_reader = XMLReaderFactory::createXMLReader();
+   XMLGrammarPool*& pool = our_grammar_pools[a_schema_file];
+   const bool have_grammar = pool != NULL;
+
+   if (!have_grammar)
+      pool = new XMLGrammarPoolImpl(XMLPlatformUtils::fgMemoryManager);
+
+   my_reader = XMLReaderFactory::createXMLReader(
+      XMLPlatformUtils::fgMemoryManager, pool);
    
    my_reader->setFeature(XMLUni::fgSAX2CoreValidation, true);
    my_reader->setFeature(XMLUni::fgSAX2CoreNameSpaces, true);
@@ -138,9 +220,10 @@ XercesXMLParser::XercesXMLParser(const string& a_schema_file)
    my_reader->setErrorHandler(my_handler);
    my_reader->setEntityResolver(my_handler);
 
-   // Cache the grammar
+   // Cache the grammar unless another parser has already
    try {
-      my_reader->loadGrammar(schema_name, Grammar::SchemaGrammarType, true);
+      if (!have_grammar)
+         my_reader->loadGrammar(schema_name, Grammar::SchemaGrammarType, true);
 
       // Always use the cached grammar
       my_reader->setFeature(XMLUni::fgXercesUseCachedGrammarInParse, true);
@@ -168,6 +251,7 @@ XercesXMLParser::~XercesXMLParser()
 void XercesXMLParser::parse(const string& a_file_name, IXMLCallback& a_callback)
 {
    my_handler->callback_ptr = &a_callback;
+   my_handler->reset();
 
    try {
       my_reader->parse(a_file_name.c_str());
@@ -186,8 +270,25 @@ void XercesXMLParser::parse(const string& a_file_name, IXMLCallback& a_callback)
    my_handler->callback_ptr = NULL;
 }
 
+namespace {
+   bool validate_xml = false;
+}
+
+void set_xml_validation(bool on_off)
+{
+   validate_xml = on_off;
+}
+
+bool xml_validation()
+{
+   return validate_xml;
+}
+
 // Create a Xerces parser for a schema and return a handle to it
 IXMLParserPtr make_xml_parser(const std::string& a_schema_file)
 {
-   return IXMLParserPtr(new XercesXMLParser(a_schema_file));
+   if (validate_xml)
+      return IXMLParserPtr(new XercesXMLParser(a_schema_file));
+   else
+      return make_fast_xml_parser();
 }
@@ -52,6 +52,7 @@ public:
    // IXMLCallback interface
    void start_element(const string& local_name, const AttributeSet &attrs);
    void end_element(const string& local_name);
+   bool wants_text(const string& local_name) const { return false; }
 private:
 
    // Manages paths during parsing
@@ -0,0 +1,178 @@
+//
+// Compare the old per-part train physics loop with the Consist arrays
+//
+//   make ConsistBench && ./bin/ConsistBench
+//
+// This times a model of the two versions of Train::update using stand
+// in vehicles and parts so it runs without the game's resources. The
+// "skip" column is the old loop with the flat track test added so the
+// gain from the array layout can be told apart from the gain from not
+// calling the gradient function on flat track
+//
+
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <chrono>
+#include <cassert>
+#include <cmath>
+
+#include "Consist.hpp"
+
+namespace {
+
+   // Stand-ins for Engine and Waggon with the same virtual interface
+   struct Vehicle {
+      virtual ~Vehicle() {}
+      virtual void update(int delta, double gravity) = 0;
+      virtual double mass() const = 0;
+   };
+
+   struct Loco : Vehicle {
+      Loco() : speed(0.0) {}
+      void update(int delta, double gravity)
+      {
+         speed += (gravity / 29.0) * (delta / 1000.0);
+      }
+      double mass() const { return 29.0; }
+      double speed;
+   };
+
+   struct Truck : Vehicle {
+      void update(int delta, double gravity) {}
+      double mass() const { return 1.0; }
+   };
+
+   float slope_gradient(float d) { return 0.1f * sinf(d); }
+   float flat_gradient(float d) { return 0.0f; }
+
+   // What Train::update used to do for each part
+   struct Part {
+      Vehicle* vehicle;
+      float segment_delta;
+      function<float (float)> gradientf;
+      bool flat;
+      int direction_x, direction_z;
+      float movement_sign;
+   };
+
+   double old_path(list<Part>& parts, int delta, bool skip_flat)
+   {
+      double gravity_sum = 0.0;
+      for (list<Part>::iterator it = parts.begin();
+           it != parts.end(); ++it) {
+         if (skip_flat && (*it).flat)
+            continue;
+
+         float gradient = (*it).gradientf((*it).segment_delta);
+
+         if ((*it).direction_x < 0 || (*it).direction_z < 0)
+            gradient *= -1.0f;
+
+         gradient *= (*it).movement_sign;
+
+         const double g = 9.78;
+         gravity_sum += -g * gradient * (*it).vehicle->mass();
+      }
+
+      for (list<Part>::iterator it = parts.begin();
+           it != parts.end(); ++it)
+         (*it).vehicle->update(delta, gravity_sum);
+
+      return gravity_sum;
+   }
+
+   // Train::update only looks at the parts when some are on slopes
+   double new_path(Consist& consist, const list<Part>& parts,
+                   unsigned sloped_parts, Vehicle* engine, int delta)
+   {
+      if (sloped_parts > 0) {
+         size_t i = 0;
+         for (list<Part>::const_iterator it = parts.begin();
+              it != parts.end(); ++it, ++i) {
+            if ((*it).flat)
+               continue;
+
+            float gradient = (*it).gradientf((*it).segment_delta);
+
+            if ((*it).direction_x < 0 || (*it).direction_z < 0)
+               gradient *= -1.0f;
+
+            consist.set_gradient(i, gradient * (*it).movement_sign);
+         }
+      }
+
+      const double gravity_sum = consist.gravity();
+      engine->update(delta, gravity_sum);
+      return gravity_sum;
+   }
+
+   typedef chrono::steady_clock Clock;
+
+   double elapsed_ns(Clock::time_point start, int iters)
+   {
+      return chrono::duration<double, nano>(Clock::now() - start).count()
+         / iters;
+   }
+
+   void bench(int n_vehicles, bool sloped)
+   {
+      list<Part> parts;
+      Consist consist;
+      Loco engine;
+      Truck truck;
+
+      for (int i = 0; i < n_vehicles; i++) {
+         Vehicle* v = i == 0 ? static_cast<Vehicle*>(&engine) : &truck;
+         Part p = { v, 0.1f * i,
+                    sloped ? slope_gradient : flat_gradient, !sloped,
+                    1, 0, 1.0f };
+         parts.push_back(p);
+         consist.add(v->mass());
+      }
+
+      const unsigned sloped_parts = sloped ? n_vehicles : 0;
+
+      const int iters = 2000000 / n_vehicles;
+      double check_old = 0.0, check_skip = 0.0, check_new = 0.0;
+
+      Clock::time_point start = Clock::now();
+      for (int i = 0; i < iters; i++)
+         check_old += old_path(parts, 20, false);
+      const double t_old = elapsed_ns(start, iters);
+
+      start = Clock::now();
+      for (int i = 0; i < iters; i++)
+         check_skip += old_path(parts, 20, true);
+      const double t_skip = elapsed_ns(start, iters);
+
+      start = Clock::now();
+      for (int i = 0; i < iters; i++)
+         check_new += new_path(consist, parts, sloped_parts, &engine, 20);
+      const double t_new = elapsed_ns(start, iters);
+
+      assert(abs(check_old - check_new) <= 1e-6 * abs(check_old) + 1e-6);
+      assert(abs(check_skip - check_new) <= 1e-6 * abs(check_skip) + 1e-6);
+
+      cout << setw(5) << n_vehicles << " vehicles "
+           << (sloped ? "(sloped)" : "(flat)  ") << ": "
+           << fixed << setprecision(1)
+           << setw(9) << t_old << "ns old  "
+           << setw(9) << t_skip << "ns skip  "
+           << setw(9) << t_new << "ns consist  ("
+           << setprecision(2) << t_old / t_new << "x, "
+           << t_skip / t_new << "x)" << endl;
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const int sizes[] = { 5, 50, 500 };
+
+   for (size_t i = 0; i < sizeof(sizes) / sizeof(int); i++) {
+      bench(sizes[i], false);
+      bench(sizes[i], true);
+   }
+
+   return 0;
+}
@@ -0,0 +1,170 @@
+//
+// Check heights survive the compact encoding and report how small it
+// is and how fast it decodes, on the maps in the tree and a large
+// made up one
+//
+//   make HeightCodecTest && ./bin/HeightCodecTest
+//
+// Run from the top of the source tree
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+
+#include "HeightCodec.hpp"
+
+namespace {
+
+   typedef chrono::steady_clock Clock;
+
+   // Something like what the editor makes: mostly flat with hills
+   // raised in whole steps and a few smoothed slopes
+   void make_terrain(int columns, int rows, vector<float>& heights)
+   {
+      heights.assign(size_t(columns) * rows, 0.0f);
+
+      srand(42);
+      for (int hill = 0; hill < columns / 8; hill++) {
+         const int cx = rand() % columns, cy = rand() % rows;
+         const int r = 4 + rand() % 24;
+         const int steps = 1 + rand() % 10;
+         const bool smooth = rand() % 3 == 0;
+
+         for (int y = max(0, cy - r); y < min(rows, cy + r); y++) {
+            for (int x = max(0, cx - r); x < min(columns, cx + r); x++) {
+               const int d = max(abs(x - cx), abs(y - cy));
+               const float t = 1.0f - float(d) / r;
+
+               float& h = heights[x + y * columns];
+               if (smooth)
+                  h += steps * 0.2f * t;
+               else {
+                  for (int i = 0; i < int(steps * t); i++)
+                     h += 0.2f;
+               }
+            }
+         }
+      }
+   }
+
+   bool check(const char* what, const vector<float>& heights,
+              int columns, int rows)
+   {
+      using namespace height_codec;
+
+      vector<uint8_t> encoded;
+      if (!encode(&heights[0], columns, rows, encoded)) {
+         cerr << what << ": heights out of range" << endl;
+         return false;
+      }
+
+      vector<float> decoded(heights.size());
+      decode(&encoded[0], encoded.size(), columns, rows, &decoded[0]);
+
+      float worst = 0.0f;
+      for (size_t i = 0; i < heights.size(); i++)
+         worst = max(worst, fabsf(heights[i] - decoded[i]));
+
+      bool ok = worst <= STEP / 2;
+      if (!ok)
+         cerr << what << ": error of " << worst << endl;
+
+      // Saving again must not change anything
+      vector<uint8_t> again;
+      encode(&decoded[0], columns, rows, again);
+      if (again != encoded) {
+         cerr << what << ": not the same when encoded again" << endl;
+         ok = false;
+      }
+
+      // Damaged data must be noticed
+      try {
+         decode(&encoded[0], encoded.size() - 1, columns, rows,
+                &decoded[0]);
+         cerr << what << ": truncated data not noticed" << endl;
+         ok = false;
+      }
+      catch (const runtime_error&) {}
+
+      const int repeats = max(1, int(20000000 / heights.size()));
+
+      const Clock::time_point start = Clock::now();
+      for (int i = 0; i < repeats; i++)
+         decode(&encoded[0], encoded.size(), columns, rows, &decoded[0]);
+      const double secs =
+         chrono::duration<double>(Clock::now() - start).count();
+
+      const double raw = heights.size() * sizeof(float);
+
+      cout << setw(32) << left << what << right
+           << setw(9) << int(raw) << " -> " << setw(7) << encoded.size()
+           << " bytes (" << fixed << setprecision(1)
+           << setw(5) << raw / encoded.size() << "x)  decode "
+           << setw(7) << raw * repeats / secs / (1024 * 1024) << " MB/s"
+           << endl;
+
+      return ok;
+   }
+
+   // Height maps saved as raw floats by older versions
+   bool check_maps()
+   {
+      using namespace boost::filesystem;
+
+      if (!exists("maps"))
+         return true;
+
+      bool ok = true;
+      for (directory_iterator it("maps"); it != directory_iterator(); ++it) {
+         const path bin =
+            it->path() / (it->path().filename().string() + ".bin");
+
+         std::ifstream is(bin.string().c_str(), ios::binary);
+         int32_t w, d;
+         if (!is.read(reinterpret_cast<char*>(&w), sizeof(int32_t))
+             || !is.read(reinterpret_cast<char*>(&d), sizeof(int32_t)))
+            continue;
+
+         vector<float> heights((w + 1) * (d + 1));
+         if (!is.read(reinterpret_cast<char*>(&heights[0]),
+                      heights.size() * sizeof(float)))
+            continue;
+
+         ok = check(bin.string().c_str(), heights, w + 1, d + 1) && ok;
+      }
+
+      return ok;
+   }
+}
+
+int main(int argc, char **argv)
+{
+   bool ok = check_maps();
+
+   const int sizes[] = { 256, 1024 };
+   for (size_t i = 0; i < sizeof(sizes) / sizeof(int); i++) {
+      vector<float> heights;
+      make_terrain(sizes[i] + 1, sizes[i] + 1, heights);
+
+      ostringstream ss;
+      ss << "made up " << sizes[i] << "x" << sizes[i];
+      ok = check(ss.str().c_str(), heights, sizes[i] + 1, sizes[i] + 1)
+         && ok;
+   }
+
+   if (!ok) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   cout << "OK" << endl;
+   return 0;
+}
@@ -0,0 +1,83 @@
+//
+// Check a map still loads from its XML when the binary copy next to
+// it is truncated or corrupt
+//
+//   make MapLoadTest && ./bin/MapLoadTest
+//
+// Run from the top of the source tree
+//
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "ScratchMap.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+
+namespace {
+
+   const char* NAME = "_map_load_test";
+   const int LINE_START = 1, LINE_END = 30;
+
+   // True if the whole line of track came back
+   bool has_line(IMapPtr map)
+   {
+      for (int x = LINE_START; x <= LINE_END; x++) {
+         if (!map->is_valid_track(make_point(x, 1)))
+            return false;
+      }
+      return true;
+   }
+
+   bool try_load(const char* what)
+   {
+      bool ok;
+      try {
+         ok = has_line(load_map(NAME));
+      }
+      catch (const runtime_error& e) {
+         cerr << e.what() << endl;
+         ok = false;
+      }
+
+      cout << setw(40) << left << what << right
+           << (ok ? "ok" : "FAILED") << endl;
+      return ok;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   using namespace boost::filesystem;
+
+   ScratchMap s(NAME, 32, 4);
+   s.straight_x(LINE_START, LINE_END, 1);
+   s.map->save();
+   s.map->save_binary();
+
+   const path bin_file = s.file(".map");
+
+   bool ok = try_load("binary map");
+
+   // Cut off the end of the tiles so the header and heights still read
+   resize_file(bin_file, file_size(bin_file) - 16);
+   ok = try_load("truncated binary map") && ok;
+
+   resize_file(bin_file, 10);
+   ok = try_load("binary map header only") && ok;
+
+   {
+      boost::filesystem::ofstream of(bin_file, ios::binary | ios::trunc);
+      of << "Not a map at all";
+   }
+   ok = try_load("corrupt binary map") && ok;
+
+   if (!ok) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   cout << "OK" << endl;
+   return 0;
+}
@@ -0,0 +1,246 @@
+//
+// Compare the old stream based model reader with the mapped parser
+// on every model in the engines, waggons, trees and buildings
+//
+//   make ObjBench && ./bin/ObjBench [repeats]
+//
+// Run from the top of the source tree
+//
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+
+#include "WavefrontParser.hpp"
+
+namespace {
+
+   // Everything read from a file boiled down so the two readers can be
+   // checked against each other
+   struct Summary {
+      Summary() : statements(0), sum(0.0) {}
+
+      unsigned long statements;
+      double sum;
+   };
+
+   // Sees what the parser produces without building a mesh
+   struct Counter {
+      Counter(Summary& s) : summary(s) {}
+
+      void material_lib(const string& file_name) { summary.statements++; }
+      void use_material(const string& name) { summary.statements++; }
+      void new_material(const string& name) { summary.statements++; }
+      void diffuse_map(const string& file_name) { summary.statements++; }
+
+      void vertex(float x, float y, float z) { add(x + y + z); }
+      void normal(float x, float y, float z) { add(x + y + z); }
+      void tex_coord(float u, float v) { add(u + v); }
+      void diffuse(float r, float g, float b) { add(r + g + b); }
+      void ambient(float r, float g, float b) { add(r + g + b); }
+      void specular(float r, float g, float b) { add(r + g + b); }
+
+      void face(const wavefront::FaceVertex* corners, unsigned n,
+                unsigned line)
+      {
+         for (unsigned i = 0; i < n; i++)
+            summary.sum += corners[i].v + corners[i].vt + corners[i].vn;
+         summary.statements++;
+      }
+
+      void add(float f)
+      {
+         summary.sum += f;
+         summary.statements++;
+      }
+
+      Summary& summary;
+   };
+
+   // What Model.cpp used to do for each line
+   void old_parse(const string& file_name, bool is_obj, Summary& s)
+   {
+      ifstream f(file_name.c_str());
+
+      while (!f.eof()) {
+         string first;
+         f >> first;
+
+         if (first.empty() || first[0] == '#') {
+            // Comment
+         }
+         else if (first == "v" || first == "vn" || first == "Kd"
+                  || first == "Ka" || first == "Ks") {
+            float x, y, z;
+            f >> x >> y >> z;
+            s.sum += x + y + z;
+            s.statements++;
+         }
+         else if (first == "vt") {
+            float x, y;
+            f >> x >> y;
+            s.sum += x + y;
+            s.statements++;
+         }
+         else if (first == "mtllib" || first == "usemtl"
+                  || first == "newmtl" || first == "map_Kd") {
+            string name;
+            f >> name;
+            s.statements++;
+         }
+         else if (is_obj && first == "f") {
+            string line;
+            getline(f, line);
+            istringstream ss(line);
+
+            while (!ss.eof()) {
+               char delim1, delim2;
+               unsigned vi, vti, vni;
+               ss >> vi >> delim1;
+               if (ss.fail())
+                  break;
+
+               ss >> vti;
+               if (ss.fail()) {
+                  vti = 0;
+                  ss.clear();
+               }
+
+               ss >> delim2 >> vni;
+               s.sum += vi + vti + vni;
+            }
+
+            s.statements++;
+            continue;
+         }
+
+         getline(f, first);
+      }
+   }
+
+   void new_parse(const string& file_name, bool is_obj, Summary& s)
+   {
+      wavefront::MappedFile file(file_name);
+      Counter counter(s);
+
+      if (is_obj)
+         wavefront::parse_obj(file.begin(), file.end(), file_name, counter);
+      else
+         wavefront::parse_mtl(file.begin(), file.end(), file_name, counter);
+   }
+
+   struct ModelFile {
+      string name;
+      bool is_obj;
+      uintmax_t size;
+   };
+
+   void find_models(const char* a_class, vector<ModelFile>& files)
+   {
+      using namespace boost::filesystem;
+
+      if (!exists(a_class))
+         return;
+
+      for (directory_iterator res(a_class); res != directory_iterator();
+           ++res) {
+         if (!is_directory(res->status()))
+            continue;
+
+         for (directory_iterator it(res->path());
+              it != directory_iterator(); ++it) {
+            const string ext = it->path().extension().string();
+            if (ext == ".obj" || ext == ".mtl") {
+               ModelFile m = { it->path().string(), ext == ".obj",
+                               file_size(it->path()) };
+               files.push_back(m);
+            }
+         }
+      }
+   }
+
+   typedef chrono::steady_clock Clock;
+
+   double elapsed_s(Clock::time_point start)
+   {
+      return chrono::duration<double>(Clock::now() - start).count();
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const int repeats = argc > 1 ? atoi(argv[1]) : 20;
+
+   const char* classes[] = { "engines", "waggons", "trees", "buildings" };
+
+   vector<ModelFile> files;
+   for (size_t i = 0; i < sizeof(classes) / sizeof(char*); i++)
+      find_models(classes[i], files);
+
+   if (files.empty()) {
+      cerr << "No models found: run this from the source directory" << endl;
+      return 1;
+   }
+
+   uintmax_t bytes = 0;
+   bool ok = true;
+
+   for (vector<ModelFile>::const_iterator it = files.begin();
+        it != files.end(); ++it) {
+      bytes += (*it).size;
+
+      Summary s_old, s_new;
+      old_parse((*it).name, (*it).is_obj, s_old);
+      new_parse((*it).name, (*it).is_obj, s_new);
+
+      if (s_old.statements != s_new.statements
+          || abs(s_old.sum - s_new.sum) > 1e-4 * (abs(s_old.sum) + 1.0)) {
+         cerr << (*it).name << ": readers disagree ("
+              << s_old.statements << " statements sum " << s_old.sum
+              << " vs " << s_new.statements << " statements sum "
+              << s_new.sum << ")" << endl;
+         ok = false;
+      }
+   }
+
+   Summary s;
+
+   Clock::time_point start = Clock::now();
+   for (int r = 0; r < repeats; r++) {
+      for (vector<ModelFile>::const_iterator it = files.begin();
+           it != files.end(); ++it)
+         old_parse((*it).name, (*it).is_obj, s);
+   }
+   const double t_old = elapsed_s(start);
+
+   start = Clock::now();
+   for (int r = 0; r < repeats; r++) {
+      for (vector<ModelFile>::const_iterator it = files.begin();
+           it != files.end(); ++it)
+         new_parse((*it).name, (*it).is_obj, s);
+   }
+   const double t_new = elapsed_s(start);
+
+   const double mb = double(bytes) * repeats / (1024.0 * 1024.0);
+
+   cout << files.size() << " files, " << bytes / 1024 << "KB, "
+        << repeats << " times" << endl
+        << fixed << setprecision(1)
+        << "old:     " << setw(8) << mb / t_old << " MB/s" << endl
+        << "mapped:  " << setw(8) << mb / t_new << " MB/s  ("
+        << setprecision(2) << t_old / t_new << "x)" << endl;
+
+   if (!ok) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   return 0;
+}
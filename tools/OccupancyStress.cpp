@@ -0,0 +1,194 @@
+//
+// Run hundreds of trains round a shared loop of blocks on several
+// threads and check no block is ever held by two trains
+//
+//   make OccupancyStress && ./bin/OccupancyStress [trains] [steps]
+//
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+#include "BlockOccupancy.hpp"
+
+namespace {
+
+   // Each train holds this many consecutive blocks
+   const unsigned TRAIN_BLOCKS = 3;
+
+   // Blocks on the loop per train
+   const unsigned LOOP_RATIO = 2;
+
+   struct LoopTrain {
+      unsigned id;
+      unsigned tail;   // Last block held
+      unsigned moves, waits;
+      bool failed;
+   };
+
+   // Cheap per-thread random numbers to vary train speeds
+   unsigned xorshift(unsigned& state)
+   {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      return state;
+   }
+
+   // Keeps the threads in step so no thread runs all its trains into
+   // the back of trains another thread hasn't started moving yet
+   class Barrier {
+   public:
+      Barrier(unsigned n) : n_threads(n), waiting(0), generation(0) {}
+
+      void wait()
+      {
+         const unsigned gen = generation.load();
+         if (waiting.fetch_add(1) + 1 == n_threads) {
+            waiting.store(0);
+            generation.fetch_add(1);
+         }
+         else {
+            while (generation.load() == gen)
+               this_thread::yield();
+         }
+      }
+   private:
+      const unsigned n_threads;
+      atomic<unsigned> waiting, generation;
+   };
+
+   // Move each train forward one block at a time: reserve the block in
+   // front of the head then release the block the tail has cleared
+   void drive(BlockOccupancy& blocks, Barrier& barrier,
+              vector<LoopTrain>& trains,
+              unsigned first, unsigned stride, unsigned steps)
+   {
+      const unsigned n = blocks.size();
+      unsigned rand_state = 2463534242u + first;
+
+      for (unsigned s = 0; s < steps; s++) {
+         barrier.wait();
+
+         for (unsigned i = first; i < trains.size(); i += stride) {
+            LoopTrain& t = trains[i];
+
+            if (xorshift(rand_state) % 4 == 0)
+               continue;   // Going slowly
+
+            const unsigned next = (t.tail + TRAIN_BLOCKS) % n;
+            if (!blocks.reserve(next, t.id)) {
+               t.waits++;
+               continue;
+            }
+
+            if (!blocks.release(t.tail, t.id))
+               t.failed = true;
+
+            t.tail = (t.tail + 1) % n;
+            t.moves++;
+         }
+      }
+   }
+
+   // Every train should hold exactly the blocks from its tail to head
+   bool check(const BlockOccupancy& blocks, const vector<LoopTrain>& trains)
+   {
+      const unsigned n = blocks.size();
+      vector<unsigned> expect(n, unsigned(BlockOccupancy::FREE));
+
+      bool ok = true;
+      for (vector<LoopTrain>::const_iterator it = trains.begin();
+           it != trains.end(); ++it) {
+         if ((*it).failed) {
+            cerr << "train " << (*it).id << " released a block it "
+                 << "didn't hold" << endl;
+            ok = false;
+         }
+
+         for (unsigned b = 0; b < TRAIN_BLOCKS; b++) {
+            unsigned& e = expect[((*it).tail + b) % n];
+            if (e != BlockOccupancy::FREE) {
+               cerr << "trains " << e << " and " << (*it).id
+                    << " overlap" << endl;
+               ok = false;
+            }
+            e = (*it).id;
+         }
+      }
+
+      for (unsigned b = 0; b < n; b++) {
+         if (blocks.holder(b) != expect[b]) {
+            cerr << "block " << b << " held by " << blocks.holder(b)
+                 << " expected " << expect[b] << endl;
+            ok = false;
+         }
+      }
+
+      return ok;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   const unsigned n_trains = argc > 1 ? atoi(argv[1]) : 500;
+   const unsigned steps = argc > 2 ? atoi(argv[2]) : 2000;
+   const unsigned n_threads = max(2u, thread::hardware_concurrency());
+
+   BlockOccupancy blocks(n_trains * TRAIN_BLOCKS * LOOP_RATIO);
+
+   // Space the trains out evenly round the loop
+   vector<LoopTrain> trains(n_trains);
+   for (unsigned i = 0; i < n_trains; i++) {
+      LoopTrain t = { i + 1, i * TRAIN_BLOCKS * LOOP_RATIO, 0, 0, false };
+
+      for (unsigned b = 0; b < TRAIN_BLOCKS; b++)
+         blocks.reserve(t.tail + b, t.id);
+
+      trains[i] = t;
+   }
+
+   typedef chrono::steady_clock Clock;
+   const Clock::time_point start = Clock::now();
+
+   // Neighbouring trains are driven by different threads so they
+   // compete for the same blocks
+   Barrier barrier(n_threads);
+   vector<thread> threads;
+   for (unsigned i = 0; i < n_threads; i++)
+      threads.push_back(thread(drive, ref(blocks), ref(barrier),
+                               ref(trains), i, n_threads, steps));
+
+   for (vector<thread>::iterator it = threads.begin();
+        it != threads.end(); ++it)
+      (*it).join();
+
+   const double secs =
+      chrono::duration<double>(Clock::now() - start).count();
+
+   unsigned long moves = 0, waits = 0;
+   for (vector<LoopTrain>::const_iterator it = trains.begin();
+        it != trains.end(); ++it) {
+      moves += (*it).moves;
+      waits += (*it).waits;
+   }
+
+   cout << fixed << setprecision(3)
+        << "trains:   " << n_trains << " on " << blocks.size()
+        << " blocks" << endl
+        << "threads:  " << n_threads << endl
+        << "moves:    " << moves << " (" << (moves / secs / 1.0e6)
+        << "M/s)" << endl
+        << "waits:    " << waits << endl;
+
+   if (!check(blocks, trains)) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   cout << "OK" << endl;
+   return 0;
+}
@@ -0,0 +1,249 @@
+//
+// Check the router finds the shortest way across a set of points and
+// forgets what it knows when the track changes, then time queries on
+// a large generated network
+//
+//   make RouterTest && ./bin/RouterTest
+//
+// Run from the top of the source tree
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include "IRouter.hpp"
+#include "ScratchMap.hpp"
+
+namespace {
+
+   typedef chrono::steady_clock Clock;
+
+   double elapsed_ms(Clock::time_point start)
+   {
+      return chrono::duration<double, milli>(Clock::now() - start).count();
+   }
+
+   bool expect(const char* what, bool cond)
+   {
+      cout << setw(40) << left << what << right
+           << (cond ? "ok" : "FAILED") << endl;
+      return cond;
+   }
+
+   // Find the node for a train entering this tile heading along x
+   bool find_entry(ITrackGraphPtr g, int x, int y, unsigned& n)
+   {
+      if (g->find_node(make_pair(make_point(x, y), axis::X), n))
+         return true;
+
+      cerr << "no node at " << make_point(x, y) << endl;
+      return false;
+   }
+
+   bool same(const track::Connection& c, int x, int y)
+   {
+      return c.first == make_point(x, y) && c.second == axis::X;
+   }
+
+   bool near(float a, float b)
+   {
+      return fabsf(a - b) < 1e-3f;
+   }
+
+   // Where the points at this node send a train at the moment
+   track::Connection points_exit(ITrackGraphPtr g, unsigned n)
+   {
+      const graph::Node& node = g->node(n);
+      return node.track->next_position(
+         node.track->get_travel_token(node.entry.first, node.entry.second));
+   }
+
+   float route_length(const Route& r)
+   {
+      float length = 0.0f;
+      for (Route::const_iterator it = r.begin(); it != r.end(); ++it)
+         length += (*it).length;
+      return length;
+   }
+
+   bool small_network()
+   {
+      ScratchMap s("_router_test", 64, 6);
+
+      // The points at x = 10 split the line onto y = 1 and y = 2 and the
+      // reflected points at x = 20 join it up again
+      s.straight_x(1, 9, 1);
+      s.map->set_track_at(make_point(10, 1), make_points(axis::X, false));
+      s.straight_x(13, 17, 1);
+      s.straight_x(13, 17, 2);
+      s.map->set_track_at(make_point(20, 1), make_points(-axis::X, true));
+      s.straight_x(21, 25, 1);
+
+      // Then the points at x = 26 lead to two dead ends
+      s.map->set_track_at(make_point(26, 1), make_points(axis::X, false));
+      s.straight_x(29, 34, 1);
+      s.straight_x(29, 31, 2);
+
+      ITrackGraphPtr g = make_track_graph(s.map);
+      IRouterPtr router = make_router(g);
+
+      unsigned split, join, end_branch;
+      if (!find_entry(g, 10, 1, split) || !find_entry(g, 26, 1, join)
+          || !find_entry(g, 32, 2, end_branch))
+         return false;
+
+      // Three tiles of points either side of eight straight tiles
+      const float straight = 16.0f;
+
+      Route r;
+      bool ok = true;
+
+      // Send the first points down the branch so set_points has to
+      // change them back
+      g->node(split).track->next_state();
+
+      ok = expect("route across points",
+                  router->route(split, join, r)
+                  && r.size() == 2 && same(r[0].exit, 13, 1)
+                  && near(route_length(r), straight)) && ok;
+
+      ok = expect("distance across points",
+                  near(router->distance(split, join), straight)) && ok;
+
+      router->set_points(r);
+      ok = expect("set_points takes straight line",
+                  same(points_exit(g, split), 13, 1)) && ok;
+
+      ok = expect("route to branch",
+                  router->route(join, end_branch, r)
+                  && r.size() == 1 && same(r[0].exit, 29, 2)) && ok;
+
+      ok = expect("points still straight",
+                  same(points_exit(g, join), 29, 1)) && ok;
+
+      router->set_points(r);
+      ok = expect("set_points takes branch",
+                  same(points_exit(g, join), 29, 2)) && ok;
+
+      ok = expect("dead end goes nowhere",
+                  !router->route(end_branch, join, r) && r.empty()) && ok;
+
+      ok = expect("no way back",
+                  router->distance(join, split) < 0.0f
+                  && router->distance(split, g->root().id) < 0.0f) && ok;
+
+      // Break the straight line so the only way is round the branch
+      const unsigned revision = g->revision();
+      s.map->erase_tile(15, 1);
+
+      if (!find_entry(g, 10, 1, split) || !find_entry(g, 26, 1, join))
+         return false;
+
+      const float branch = router->distance(split, join);
+
+      ok = expect("graph changed", g->revision() != revision) && ok;
+
+      ok = expect("distance after edit", branch > straight) && ok;
+
+      ok = expect("route after edit",
+                  router->route(split, join, r)
+                  && r.size() == 2 && same(r[0].exit, 13, 2)
+                  && near(route_length(r), branch)) && ok;
+
+      return ok;
+   }
+
+   bool time_queries()
+   {
+      const int width = 256, rows = 50, n_queries = 500;
+
+      ScratchMap s("_router_bench", width, rows * 3 + 2);
+      s.points_network(rows);
+
+      ITrackGraphPtr g = make_track_graph(s.map);
+
+      // Every set of points heading along x can be reached from the
+      // start of its row
+      vector<unsigned> to, from;
+      for (unsigned n = 0; n < g->node_count(); n++) {
+         const graph::Node& node = g->node(n);
+         unsigned first;
+         if (node.type == graph::NODE_POINTS && node.entry.second == axis::X
+             && find_entry(g, 1, node.entry.first.y, first)) {
+            to.push_back(n);
+            from.push_back(first);
+         }
+      }
+
+      // There are no stations so make room for every destination as
+      // the game does for every station
+      IRouterPtr router = make_router(g, to.size());
+
+      srand(42);
+      vector<unsigned> queries(n_queries);
+      for (int i = 0; i < n_queries; i++)
+         queries[i] = rand() % to.size();
+
+      vector<float> cold(n_queries);
+      Clock::time_point start = Clock::now();
+      for (int i = 0; i < n_queries; i++)
+         cold[i] = router->distance(from[queries[i]], to[queries[i]]);
+      const double cold_ms = elapsed_ms(start);
+
+      const unsigned hits = router->cache_hits();
+      const unsigned misses = router->cache_misses();
+
+      vector<float> warm(n_queries);
+      start = Clock::now();
+      for (int i = 0; i < n_queries; i++)
+         warm[i] = router->distance(from[queries[i]], to[queries[i]]);
+      const double warm_ms = elapsed_ms(start);
+
+      const unsigned warm_hits = router->cache_hits() - hits;
+      const unsigned warm_misses = router->cache_misses() - misses;
+
+      bool ok = true;
+      Route r;
+      for (int i = 0; i < n_queries; i++) {
+         if (cold[i] < 0.0f || !near(cold[i], warm[i])
+             || !router->route(from[queries[i]], to[queries[i]], r)
+             || !near(route_length(r), cold[i])) {
+            cerr << "query " << i << " gave the wrong answer" << endl;
+            ok = false;
+            break;
+         }
+      }
+
+      cout << endl << fixed << setprecision(2)
+           << "network:     " << g->node_count() << " nodes" << endl
+           << "first:       " << cold_ms * 1000.0 / n_queries
+           << "us/query" << endl
+           << "cached:      " << warm_ms * 1000.0 / n_queries
+           << "us/query (" << 100.0 * warm_hits / (warm_hits + warm_misses)
+           << "% hits)" << endl;
+
+      if (warm_misses > 0) {
+         cerr << warm_misses << " cached queries missed" << endl;
+         ok = false;
+      }
+
+      return ok;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   bool ok = small_network();
+   ok = time_queries() && ok;
+
+   if (!ok) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   cout << "OK" << endl;
+   return 0;
+}
@@ -0,0 +1,116 @@
+//
+// Helpers for the tests which run the real game code on a map
+//
+// The map is made in its own resource directory under maps/ and the
+// directory is deleted again afterwards so run the tests from the top
+// of the source tree
+//
+
+#ifndef INC_SCRATCH_MAP_HPP
+#define INC_SCRATCH_MAP_HPP
+
+#include "IMap.hpp"
+#include "ITrackSegment.hpp"
+#include "IWindow.hpp"
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+// The tests never open a window
+IWindowPtr get_game_window()
+{
+   return IWindowPtr();
+}
+
+class ScratchMap {
+public:
+   ScratchMap(const string& a_name, int a_width, int a_depth)
+      : name(a_name)
+   {
+      check_size(a_width, a_depth);
+      remove_dir();
+      map = make_empty_map(name, a_width, a_depth);
+   }
+
+   ~ScratchMap()
+   {
+      map.reset();
+      remove_dir();
+   }
+
+   // Lay straight track along the x axis from x1 to x2 inclusive
+   void straight_x(int x1, int x2, int y)
+   {
+      for (int x = x1; x <= x2; x++)
+         map->set_track_at(make_point(x, y), make_straight_track(axis::X));
+   }
+
+   void erase_x(int x1, int x2, int y)
+   {
+      for (int x = x1; x <= x2; x++)
+         map->erase_tile(x, y);
+   }
+
+   // Rows of track three tiles apart across the whole map with a set
+   // of points every thirteen tiles whose branch runs off into a short
+   // dead end
+   // Returns the number of segments
+   int points_network(int rows)
+   {
+      const int period = 13;
+      int segments = 0;
+
+      for (int r = 0; r < rows; r++) {
+         const int y = 1 + r * 3;
+
+         for (int x = 1; x + period < map->width(); x += period) {
+            map->set_track_at(make_point(x, y),
+                              make_points(axis::X, false));
+            straight_x(x + 3, x + period - 1, y);
+            straight_x(x + 3, x + 5, y + 1);
+
+            segments += 1 + (period - 3) + 3;
+         }
+      }
+
+      return segments;
+   }
+
+   string file(const string& ext) const
+   {
+      return (boost::filesystem::path("maps") / name / (name + ext))
+         .string();
+   }
+
+   IMapPtr map;
+
+private:
+   // The quad tree splits the longer side in half down to leaves of
+   // eight tiles and never finishes on any other size
+   static void check_size(int width, int depth)
+   {
+      int side = max(width, depth);
+      while (side > 8 && side % 2 == 0)
+         side /= 2;
+
+      if (side != 8 || min(width, depth) <= 0) {
+         ostringstream ss;
+         ss << "Cannot make a " << width << "x" << depth << " map: the "
+            << "longer side must be eight times a power of two";
+         throw runtime_error(ss.str());
+      }
+   }
+
+   void remove_dir()
+   {
+      boost::filesystem::remove_all(boost::filesystem::path("maps") / name);
+   }
+
+   const string name;
+};
+
+#endif
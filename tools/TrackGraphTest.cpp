@@ -0,0 +1,185 @@
+//
+// Edit the track on a map and check the graph kept up to date by
+// TrackGraph::track_changed matches one built from scratch, then time
+// building the graph for a large generated network
+//
+//   make TrackGraphTest && ./bin/TrackGraphTest
+//
+// Run from the top of the source tree
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+
+#include "ITrackGraph.hpp"
+#include "ScratchMap.hpp"
+
+namespace {
+
+   typedef chrono::steady_clock Clock;
+
+   double elapsed_ms(Clock::time_point start)
+   {
+      return chrono::duration<double, milli>(Clock::now() - start).count();
+   }
+
+   bool same_graph(ITrackGraphPtr a, ITrackGraphPtr b)
+   {
+      if (a->node_count() != b->node_count()) {
+         cerr << a->node_count() << " nodes but expected "
+              << b->node_count() << endl;
+         return false;
+      }
+
+      for (unsigned n = 0; n < a->node_count(); n++) {
+         const graph::Node& x = a->node(n);
+         const graph::Node& y = b->node(n);
+
+         if (x.type != y.type || x.entry != y.entry
+             || x.track != y.track || x.station != y.station) {
+            cerr << "node " << n << " differs" << endl;
+            return false;
+         }
+
+         if (a->arcs_end(n) - a->arcs_begin(n)
+             != b->arcs_end(n) - b->arcs_begin(n)) {
+            cerr << "node " << n << " has a different number of arcs"
+                 << endl;
+            return false;
+         }
+
+         const graph::Arc* q = b->arcs_begin(n);
+         for (const graph::Arc* p = a->arcs_begin(n);
+              p != a->arcs_end(n); ++p, ++q) {
+            if (p->start != q->start || p->end != q->end
+                || p->exit != q->exit
+                || fabsf(p->length - q->length) > 1e-4f) {
+               cerr << "arc from node " << n << " differs" << endl;
+               return false;
+            }
+         }
+      }
+
+      return true;
+   }
+
+   bool has_type(ITrackGraphPtr g, graph::NodeType type)
+   {
+      for (unsigned n = 0; n < g->node_count(); n++) {
+         if (g->node(n).type == type)
+            return true;
+      }
+      return false;
+   }
+
+   bool check(const char* what, ITrackGraphPtr g, IMapPtr map)
+   {
+      const bool ok = same_graph(g, make_track_graph(map));
+      cout << setw(40) << left << what << right
+           << setw(4) << g->node_count() << " nodes  "
+           << (ok ? "ok" : "FAILED") << endl;
+      return ok;
+   }
+
+   bool edit_track()
+   {
+      ScratchMap s("_track_graph_test", 64, 12);
+      IMapPtr map = s.map;
+
+      // The map starts at (1, 1) heading along x
+      s.straight_x(1, 20, 1);
+
+      ITrackGraphPtr g = make_track_graph(map);
+      bool ok = check("straight line", g, map);
+
+      // Points at x = 10 cover up to x = 12 with the branch on y = 2
+      s.erase_x(10, 12, 1);
+      ok = check("gap in the line", g, map) && ok;
+
+      map->set_track_at(make_point(10, 1), make_points(axis::X, false));
+      ok = check("points", g, map) && ok;
+
+      if (!has_type(g, graph::NODE_POINTS)) {
+         cerr << "no points in the graph" << endl;
+         ok = false;
+      }
+
+      s.straight_x(13, 18, 2);
+      ok = check("branch line", g, map) && ok;
+
+      s.erase_x(15, 15, 2);
+      ok = check("gap in the branch", g, map) && ok;
+
+      // Reflected points branch off towards y = 0
+      s.erase_x(14, 16, 1);
+      map->set_track_at(make_point(14, 1), make_points(axis::X, true));
+      ok = check("second points", g, map) && ok;
+
+      s.straight_x(17, 22, 0);
+      ok = check("second branch", g, map) && ok;
+
+      map->erase_tile(10, 1);
+      ok = check("first points erased", g, map) && ok;
+
+      s.straight_x(10, 12, 1);
+      ok = check("line mended", g, map) && ok;
+
+      map->erase_tile(14, 1);
+      s.straight_x(14, 16, 1);
+      ok = check("all points erased", g, map) && ok;
+
+      if (has_type(g, graph::NODE_POINTS)) {
+         cerr << "points left in the graph" << endl;
+         ok = false;
+      }
+
+      return ok;
+   }
+
+   bool time_build()
+   {
+      const int width = 256, rows = 50;
+
+      ScratchMap s("_track_graph_bench", width, rows * 3 + 2);
+      const int segments = s.points_network(rows);
+
+      Clock::time_point start = Clock::now();
+      ITrackGraphPtr g = make_track_graph(s.map);
+      const double build_ms = elapsed_ms(start);
+
+      unsigned n_arcs = 0;
+      for (unsigned n = 0; n < g->node_count(); n++)
+         n_arcs += g->arcs_end(n) - g->arcs_begin(n);
+
+      // Replace one piece of straight track in the middle
+      const PointI p = make_point(width / 2, 1 + (rows / 2) * 3);
+      start = Clock::now();
+      s.map->erase_tile(p.x, p.y);
+      s.map->set_track_at(p, make_straight_track(axis::X));
+      const double update_ms = elapsed_ms(start);
+
+      cout << endl << fixed << setprecision(2)
+           << "network:     " << segments << " segments, "
+           << g->node_count() << " nodes, " << n_arcs << " arcs" << endl
+           << "build:       " << build_ms << "ms" << endl
+           << "edit:        " << update_ms << "ms" << endl;
+
+      return same_graph(g, make_track_graph(s.map));
+   }
+}
+
+int main(int argc, char** argv)
+{
+   bool ok = edit_track();
+   ok = time_build() && ok;
+
+   if (!ok) {
+      cout << "FAILED" << endl;
+      return 1;
+   }
+
+   cout << "OK" << endl;
+   return 0;
+}